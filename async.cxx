@@ -0,0 +1,403 @@
+#include "async.h"
+
+#ifndef _WIN32
+
+#include "pool.h"
+
+#include <cstring>
+#include <climits>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(STATX_BASIC_STATS) && __has_include(<linux/io_uring.h>)
+#define FILESYSTEM_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+struct AsyncIOT::RequestT
+{
+	enum struct OperationT { Open, Read, Write, Close, Stat };
+
+	OperationT Operation;
+	PathT Path;
+	std::string Rendered;
+	int Flags = 0, Mode = 0, Descriptor = -1;
+	uint64_t Offset = 0;
+	void *Data = nullptr;
+	size_t Size = 0;
+	std::function<void(int64_t Result)> Done;
+	std::function<void(OptionalT<StatT> const &Result)> StatDone;
+	OptionalT<StatT> StatResult;
+#ifdef FILESYSTEM_IO_URING
+	struct statx StatBuffer;
+#endif
+};
+
+#ifdef FILESYSTEM_IO_URING
+struct AsyncIOT::RingT
+{
+	static std::unique_ptr<RingT> Create(unsigned Depth)
+	{
+		io_uring_params Parameters;
+		memset(&Parameters, 0, sizeof(Parameters));
+		auto const Core = static_cast<int>(syscall(__NR_io_uring_setup, Depth, &Parameters));
+		if (Core < 0) return nullptr;
+		auto Out = std::make_unique<RingT>(Core);
+
+		Out->SubmitMapSize = Parameters.sq_off.array + Parameters.sq_entries * sizeof(unsigned);
+		Out->CompleteMapSize = Parameters.cq_off.cqes + Parameters.cq_entries * sizeof(io_uring_cqe);
+		bool const Single = Parameters.features & IORING_FEAT_SINGLE_MMAP;
+		if (Single) Out->SubmitMapSize = Out->CompleteMapSize = std::max(Out->SubmitMapSize, Out->CompleteMapSize);
+		Out->SubmitMap = mmap(nullptr, Out->SubmitMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Core, IORING_OFF_SQ_RING);
+		if (Out->SubmitMap == MAP_FAILED) return nullptr;
+		if (Single) Out->CompleteMap = Out->SubmitMap;
+		else
+		{
+			Out->CompleteMap = mmap(nullptr, Out->CompleteMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Core, IORING_OFF_CQ_RING);
+			if (Out->CompleteMap == MAP_FAILED) return nullptr;
+		}
+		Out->EntriesSize = Parameters.sq_entries * sizeof(io_uring_sqe);
+		auto const Entries = mmap(nullptr, Out->EntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Core, IORING_OFF_SQES);
+		if (Entries == MAP_FAILED) return nullptr;
+		Out->Entries = static_cast<io_uring_sqe *>(Entries);
+
+		auto const Submit = static_cast<uint8_t *>(Out->SubmitMap);
+		Out->SubmitHead = reinterpret_cast<unsigned *>(Submit + Parameters.sq_off.head);
+		Out->SubmitTail = reinterpret_cast<unsigned *>(Submit + Parameters.sq_off.tail);
+		Out->SubmitMask = *reinterpret_cast<unsigned *>(Submit + Parameters.sq_off.ring_mask);
+		Out->SubmitCount = Parameters.sq_entries;
+		Out->SubmitArray = reinterpret_cast<unsigned *>(Submit + Parameters.sq_off.array);
+		auto const Complete = static_cast<uint8_t *>(Out->CompleteMap);
+		Out->CompleteHead = reinterpret_cast<unsigned *>(Complete + Parameters.cq_off.head);
+		Out->CompleteTail = reinterpret_cast<unsigned *>(Complete + Parameters.cq_off.tail);
+		Out->CompleteMask = *reinterpret_cast<unsigned *>(Complete + Parameters.cq_off.ring_mask);
+		Out->Completions = reinterpret_cast<io_uring_cqe *>(Complete + Parameters.cq_off.cqes);
+
+		// Older kernels have rings but not every operation used here
+		std::vector<uint8_t> ProbeBuffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+		auto Probe = reinterpret_cast<io_uring_probe *>(ProbeBuffer.data());
+		if (syscall(__NR_io_uring_register, Core, IORING_REGISTER_PROBE, Probe, 256) < 0) return nullptr;
+		for (auto Operation : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_STATX})
+		{
+			if (Operation > Probe->last_op) return nullptr;
+			if (!(Probe->ops[Operation].flags & IO_URING_OP_SUPPORTED)) return nullptr;
+		}
+		return Out;
+	}
+
+	RingT(int Core) : Core(Core) {}
+
+	~RingT(void)
+	{
+		if (Entries) munmap(Entries, EntriesSize);
+		if (CompleteMap && (CompleteMap != MAP_FAILED) && (CompleteMap != SubmitMap)) munmap(CompleteMap, CompleteMapSize);
+		if (SubmitMap && (SubmitMap != MAP_FAILED)) munmap(SubmitMap, SubmitMapSize);
+		close(Core);
+	}
+
+	io_uring_sqe *Next(void)
+	{
+		auto const Tail = *SubmitTail;
+		if (Tail - __atomic_load_n(SubmitHead, __ATOMIC_ACQUIRE) >= SubmitCount) return nullptr;
+		auto const Index = Tail & SubmitMask;
+		SubmitArray[Index] = Index;
+		memset(&Entries[Index], 0, sizeof(io_uring_sqe));
+		return &Entries[Index];
+	}
+
+	void Commit(void) { __atomic_store_n(SubmitTail, *SubmitTail + 1, __ATOMIC_RELEASE); }
+
+	void Enter(bool Block)
+	{
+		while (true)
+		{
+			auto const Unsubmitted = *SubmitTail - __atomic_load_n(SubmitHead, __ATOMIC_ACQUIRE);
+			if ((Unsubmitted == 0) && !Block) return;
+			auto const Result = syscall(__NR_io_uring_enter, Core, Unsubmitted, Block ? 1 : 0, Block ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+			if (Result >= 0) return;
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) continue;
+			throw SYSTEM_ERROR << "io_uring_enter failed: " << strerror(errno);
+		}
+	}
+
+	bool Reap(AsyncIOT::RequestT *&Request, int64_t &Result)
+	{
+		auto const Head = *CompleteHead;
+		if (Head == __atomic_load_n(CompleteTail, __ATOMIC_ACQUIRE)) return false;
+		auto const &Completion = Completions[Head & CompleteMask];
+		Request = reinterpret_cast<AsyncIOT::RequestT *>(Completion.user_data);
+		Result = Completion.res;
+		__atomic_store_n(CompleteHead, Head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	int const Core;
+	void *SubmitMap = nullptr, *CompleteMap = nullptr;
+	size_t SubmitMapSize = 0, CompleteMapSize = 0, EntriesSize = 0;
+	io_uring_sqe *Entries = nullptr;
+	unsigned *SubmitHead, *SubmitTail, *SubmitArray, SubmitMask, SubmitCount;
+	unsigned *CompleteHead, *CompleteTail, CompleteMask;
+	io_uring_cqe *Completions;
+};
+
+static StatT FromStatx(struct statx const &Result)
+{
+	StatT Out;
+	Out.Type = TypeFromMode(Result.stx_mode);
+	Out.Size = Result.stx_size;
+	Out.Modified = static_cast<int64_t>(Result.stx_mtime.tv_sec) * 1000000000 + Result.stx_mtime.tv_nsec;
+	Out.Changed = static_cast<int64_t>(Result.stx_ctime.tv_sec) * 1000000000 + Result.stx_ctime.tv_nsec;
+	Out.Mode = Result.stx_mode;
+	Out.Inode = Result.stx_ino;
+	Out.Device = makedev(Result.stx_dev_major, Result.stx_dev_minor);
+	return Out;
+}
+#else
+struct AsyncIOT::RingT {};
+#endif
+
+AsyncIOT::AsyncIOT(size_t Depth, bool AllowRing) : Depth(std::max<size_t>(1, Depth))
+{
+#ifdef FILESYSTEM_IO_URING
+	if (AllowRing) Ring = RingT::Create(this->Depth);
+#endif
+	if (!Ring) Pool = std::make_unique<WorkPoolT>(std::min<size_t>(this->Depth, 16));
+}
+
+AsyncIOT::~AsyncIOT(void)
+{
+	try { Drain(); }
+	catch (...) {}
+}
+
+bool AsyncIOT::UsesRing(void) const { return bool(Ring); }
+
+size_t AsyncIOT::Pending(void) const { return Outstanding; }
+
+void AsyncIOT::Open(PathT const &Path, int Flags, std::function<void(int64_t Result)> &&Done, int Mode)
+{
+	auto Request = std::make_unique<RequestT>();
+	Request->Operation = RequestT::OperationT::Open;
+	Request->Rendered = Path.Render();
+	Request->Flags = Flags;
+	Request->Mode = Mode;
+	Request->Done = std::move(Done);
+	Queue(std::move(Request));
+}
+
+void AsyncIOT::Read(int Descriptor, uint64_t Offset, void *Data, size_t Size, std::function<void(int64_t Result)> &&Done)
+{
+	auto Request = std::make_unique<RequestT>();
+	Request->Operation = RequestT::OperationT::Read;
+	Request->Descriptor = Descriptor;
+	Request->Offset = Offset;
+	Request->Data = Data;
+	Request->Size = Size;
+	Request->Done = std::move(Done);
+	Queue(std::move(Request));
+}
+
+void AsyncIOT::Write(int Descriptor, uint64_t Offset, void const *Data, size_t Size, std::function<void(int64_t Result)> &&Done)
+{
+	auto Request = std::make_unique<RequestT>();
+	Request->Operation = RequestT::OperationT::Write;
+	Request->Descriptor = Descriptor;
+	Request->Offset = Offset;
+	Request->Data = const_cast<void *>(Data);
+	Request->Size = Size;
+	Request->Done = std::move(Done);
+	Queue(std::move(Request));
+}
+
+void AsyncIOT::Close(int Descriptor, std::function<void(int64_t Result)> &&Done)
+{
+	auto Request = std::make_unique<RequestT>();
+	Request->Operation = RequestT::OperationT::Close;
+	Request->Descriptor = Descriptor;
+	Request->Done = std::move(Done);
+	Queue(std::move(Request));
+}
+
+void AsyncIOT::OpenFile(PathT const &Path, int Flags, std::function<void(RawFileT &&File, int64_t Result)> &&Done, int Mode)
+{
+	Open(Path, Flags, [Name = Path.Render(), Done = std::move(Done)](int64_t Result)
+	{
+		Done((Result >= 0) ? RawFileT::Adopt(Name, static_cast<int>(Result)) : RawFileT(), Result);
+	}, Mode);
+}
+
+void AsyncIOT::Read(RawFileT const &File, uint64_t Offset, void *Data, size_t Size, std::function<void(int64_t Result)> &&Done)
+	{ Read(File.Descriptor(), Offset, Data, Size, std::move(Done)); }
+
+void AsyncIOT::Write(RawFileT const &File, uint64_t Offset, void const *Data, size_t Size, std::function<void(int64_t Result)> &&Done)
+	{ Write(File.Descriptor(), Offset, Data, Size, std::move(Done)); }
+
+void AsyncIOT::Close(RawFileT &&File, std::function<void(int64_t Result)> &&Done) { Close(File.Release(), std::move(Done)); }
+
+void AsyncIOT::Stat(PathT const &Path, std::function<void(OptionalT<StatT> const &Result)> &&Done)
+{
+	auto Request = std::make_unique<RequestT>();
+	Request->Operation = RequestT::OperationT::Stat;
+	Request->Path = Path;
+	Request->Rendered = Path.Render();
+	Request->StatDone = std::move(Done);
+	Queue(std::move(Request));
+}
+
+void AsyncIOT::Submit(void)
+{
+#ifdef FILESYSTEM_IO_URING
+	if (Ring)
+	{
+		while (!Queued.empty() && (Running < Depth))
+		{
+			auto Entry = Ring->Next();
+			if (!Entry) break;
+			auto &Request = *Queued.front();
+			switch (Request.Operation)
+			{
+				case RequestT::OperationT::Open:
+					Entry->opcode = IORING_OP_OPENAT;
+					Entry->fd = AT_FDCWD;
+					Entry->addr = reinterpret_cast<uintptr_t>(Request.Rendered.c_str());
+					Entry->len = Request.Mode;
+					Entry->open_flags = Request.Flags | O_CLOEXEC;
+					break;
+				case RequestT::OperationT::Read:
+				case RequestT::OperationT::Write:
+					Entry->opcode = Request.Operation == RequestT::OperationT::Read ? IORING_OP_READ : IORING_OP_WRITE;
+					Entry->fd = Request.Descriptor;
+					Entry->addr = reinterpret_cast<uintptr_t>(Request.Data);
+					Entry->len = static_cast<uint32_t>(std::min<size_t>(Request.Size, INT_MAX)); // Short transfers like read(2)
+					Entry->off = Request.Offset;
+					break;
+				case RequestT::OperationT::Close:
+					Entry->opcode = IORING_OP_CLOSE;
+					Entry->fd = Request.Descriptor;
+					break;
+				case RequestT::OperationT::Stat:
+					Entry->opcode = IORING_OP_STATX;
+					Entry->fd = AT_FDCWD;
+					Entry->addr = reinterpret_cast<uintptr_t>(Request.Rendered.c_str());
+					Entry->len = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME;
+					Entry->addr2 = reinterpret_cast<uintptr_t>(&Request.StatBuffer);
+					break;
+			}
+			Entry->user_data = reinterpret_cast<uintptr_t>(Queued.front().release());
+			Ring->Commit();
+			Queued.pop_front();
+			Running += 1;
+		}
+		Ring->Enter(false);
+		return;
+	}
+#endif
+	while (!Queued.empty())
+	{
+		auto Request = Queued.front().release();
+		Queued.pop_front();
+		Running += 1;
+		Pool->Push([this, Request](void)
+		{
+			auto const Result = Execute(*Request);
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Completed.emplace_back(std::unique_ptr<RequestT>(Request), Result);
+			Finished.notify_one();
+		});
+	}
+}
+
+size_t AsyncIOT::Wait(size_t Minimum)
+{
+	size_t Count = 0;
+	Submit();
+	while ((Count < Minimum) && (Outstanding > 0))
+	{
+#ifdef FILESYSTEM_IO_URING
+		if (Ring)
+		{
+			RequestT *Raw;
+			int64_t Result;
+			if (!Ring->Reap(Raw, Result))
+			{
+				Ring->Enter(true);
+				continue;
+			}
+			std::unique_ptr<RequestT> Request(Raw);
+			Running -= 1;
+			if ((Request->Operation == RequestT::OperationT::Stat) && (Result == 0))
+				Request->StatResult = FromStatx(Request->StatBuffer);
+			Finish(*Request, Result);
+			Count += 1;
+			Submit();
+			continue;
+		}
+#endif
+		decltype(Completed) Batch;
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Finished.wait(Lock, [&](void) { return !Completed.empty(); });
+			Batch.swap(Completed);
+		}
+		for (auto &Done : Batch)
+		{
+			Running -= 1;
+			Finish(*Done.first, Done.second);
+			Count += 1;
+		}
+		Submit();
+	}
+	return Count;
+}
+
+void AsyncIOT::Drain(void)
+{
+	while (Outstanding > 0) Wait(Outstanding);
+}
+
+void AsyncIOT::Queue(std::unique_ptr<RequestT> &&Request)
+{
+	Queued.push_back(std::move(Request));
+	Outstanding += 1;
+}
+
+void AsyncIOT::Finish(RequestT &Request, int64_t Result)
+{
+	Outstanding -= 1;
+	if (Request.Operation == RequestT::OperationT::Stat)
+	{
+		if (Request.StatDone) Request.StatDone(Request.StatResult);
+	}
+	else if (Request.Done) Request.Done(Result);
+}
+
+int64_t AsyncIOT::Execute(RequestT &Request)
+{
+	using OperationT = RequestT::OperationT;
+	int64_t Result = 0;
+	switch (Request.Operation)
+	{
+		case OperationT::Open: Result = open(Request.Rendered.c_str(), Request.Flags | O_CLOEXEC, Request.Mode); break;
+		case OperationT::Read: Result = pread(Request.Descriptor, Request.Data, Request.Size, Request.Offset); break;
+		case OperationT::Write: Result = pwrite(Request.Descriptor, Request.Data, Request.Size, Request.Offset); break;
+		case OperationT::Close: Result = close(Request.Descriptor); break;
+		case OperationT::Stat:
+			Request.StatResult = Request.Path.Stat();
+			return Request.StatResult ? 0 : -ENOENT;
+	}
+	return Result < 0 ? -errno : Result;
+}
+
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef ren_cxx_filesystem__async_h
+#define ren_cxx_filesystem__async_h
+
+#include "path.h"
+#include "file.h"
+
+#include <deque>
+#include <condition_variable>
+
+#ifndef _WIN32
+namespace Filesystem
+{
+
+struct WorkPoolT;
+
+// Queues file operations and runs them as a batch.  Completion callbacks run on the
+// thread calling Wait, which may queue more operations from them.  Uses io_uring where
+// the kernel supports every operation and a worker pool otherwise.
+//
+// Results are a descriptor or byte count on success and -errno on failure.  Buffers and
+// descriptors must stay valid until the operation's callback runs; the RawFileT forms
+// leave ownership of the descriptor with the RawFileT until Close takes it.
+struct AsyncIOT
+{
+	AsyncIOT(size_t Depth = 256, bool AllowRing = true);
+	AsyncIOT(AsyncIOT const &Other) = delete;
+	AsyncIOT &operator =(AsyncIOT const &Other) = delete;
+	~AsyncIOT(void); // Waits for everything outstanding
+
+	bool UsesRing(void) const;
+	size_t Pending(void) const;
+
+	void Open(PathT const &Path, int Flags, std::function<void(int64_t Result)> &&Done, int Mode = 0666);
+	void Read(int Descriptor, uint64_t Offset, void *Data, size_t Size, std::function<void(int64_t Result)> &&Done);
+	void Write(int Descriptor, uint64_t Offset, void const *Data, size_t Size, std::function<void(int64_t Result)> &&Done);
+	void Close(int Descriptor, std::function<void(int64_t Result)> &&Done);
+	void Stat(PathT const &Path, std::function<void(OptionalT<StatT> const &Result)> &&Done);
+
+	// File is empty unless Result is a descriptor
+	void OpenFile(PathT const &Path, int Flags, std::function<void(RawFileT &&File, int64_t Result)> &&Done, int Mode = 0666);
+	void Read(RawFileT const &File, uint64_t Offset, void *Data, size_t Size, std::function<void(int64_t Result)> &&Done);
+	void Write(RawFileT const &File, uint64_t Offset, void const *Data, size_t Size, std::function<void(int64_t Result)> &&Done);
+	void Close(RawFileT &&File, std::function<void(int64_t Result)> &&Done); // Takes the descriptor from File
+
+	void Submit(void);
+	size_t Wait(size_t Minimum = 1); // Submits, then runs at least Minimum callbacks if that many are pending
+	void Drain(void); // Runs until nothing is pending
+
+	private:
+		struct RequestT;
+		struct RingT;
+
+		static int64_t Execute(RequestT &Request);
+		void Queue(std::unique_ptr<RequestT> &&Request);
+		void Finish(RequestT &Request, int64_t Result);
+
+		size_t const Depth;
+		size_t Outstanding = 0, Running = 0;
+		std::deque<std::unique_ptr<RequestT>> Queued;
+		std::unique_ptr<RingT> Ring;
+
+		std::mutex Mutex;
+		std::condition_variable Finished;
+		std::vector<std::pair<std::unique_ptr<RequestT>, int64_t>> Completed;
+		std::unique_ptr<WorkPoolT> Pool; // Last, so workers stop before what they touch goes away
+};
+
+}
+#endif
+
+#endif
@@ -0,0 +1,174 @@
+#include "atomicwrite.h"
+
+#ifndef _WIN32
+
+#include <cstring>
+#include <atomic>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+static void SyncDirectory(PathT const &Path, int Descriptor)
+{
+	while (fsync(Descriptor) != 0)
+	{
+		if (errno == EINTR) continue;
+		throw SYSTEM_ERROR << "Error syncing directory [" << Path << "]: " << strerror(errno);
+	}
+}
+
+CommitGroupT::CommitGroupT(void) {}
+
+CommitGroupT::~CommitGroupT(void)
+{
+	try { Commit(); }
+	catch (...) {}
+}
+
+size_t CommitGroupT::Pending(void) const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return Directories.size();
+}
+
+void CommitGroupT::Commit(void)
+{
+	decltype(Directories) Syncing;
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Syncing.swap(Directories);
+	}
+	OptionalT<std::string> Error;
+	for (auto &Directory : Syncing)
+	{
+		try { SyncDirectory(Directory.first, Directory.second); }
+		catch (std::exception const &Caught) { if (!Error) Error = std::string(Caught.what()); }
+		close(Directory.second);
+	}
+	if (Error) throw SYSTEM_ERROR << *Error;
+}
+
+void CommitGroupT::Add(PathT const &Directory, int Descriptor)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	if (!Directories.emplace(Directory, Descriptor).second) close(Descriptor);
+}
+
+AtomicWriteT AtomicWriteT::Open(PathT const &Destination, int Mode, CommitGroupT *Group)
+{
+	AtomicWriteT Out(Destination, Group);
+	auto const Parent = Destination.Exit();
+	Out.Directory = open(Parent.Render().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (Out.Directory < 0)
+		throw CONSTRUCTION_ERROR << "Unable to open directory [" << Parent << "]: " << strerror(errno);
+	int Descriptor = -1;
+#ifdef O_TMPFILE
+	Descriptor = openat(Out.Directory, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, Mode);
+#endif
+	if (Descriptor < 0)
+	{
+		// Unsupported here (old kernel or filesystem), so use a name that can be cleaned up
+		Out.Temporary = Out.Claim(Destination.Filename(), [&](std::string const &Candidate)
+		{
+			Descriptor = openat(Out.Directory, Candidate.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, Mode);
+			return Descriptor >= 0;
+		});
+	}
+	Out.Core = RawFileT::Adopt(Destination.Render(), Descriptor);
+	return Out;
+}
+
+void AtomicWriteT::Publish(PathT const &Destination, WriteSpanT const &Data, int Mode, CommitGroupT *Group)
+{
+	auto Write = Open(Destination, Mode, Group);
+	Write.File().Write(Data.Data, Data.Size);
+	Write.Commit();
+}
+
+std::string AtomicWriteT::Claim(std::string const &Name, std::function<bool(std::string const &Candidate)> const &Create) const
+{
+	// Hidden sibling names; unique within the process by the counter and between processes by pid
+	static std::atomic<uint64_t> Counter{0};
+	while (true)
+	{
+		auto Candidate = "." + Name + "." + std::to_string(getpid()) + "." + std::to_string(Counter++);
+		if (Create(Candidate)) return Candidate;
+		if (errno != EEXIST)
+			throw SYSTEM_ERROR << "Unable to create temporary file for [" << Destination << "]: " << strerror(errno);
+	}
+}
+
+AtomicWriteT::AtomicWriteT(PathT const &Destination, CommitGroupT *Group) : 
+	Destination(Destination), Group(Group), Directory(-1) 
+{
+}
+
+AtomicWriteT::AtomicWriteT(AtomicWriteT &&Other) : 
+	Destination(std::move(Other.Destination)),
+	Group(Other.Group),
+	Directory(Other.Directory),
+	Temporary(std::move(Other.Temporary)),
+	Core(std::move(Other.Core))
+{
+	Other.Directory = -1;
+	Other.Temporary = {};
+}
+
+AtomicWriteT::~AtomicWriteT(void) { Discard(); }
+
+RawFileT &AtomicWriteT::File(void) 
+{ 
+	Assert(Core.Descriptor() >= 0);
+	return Core; 
+}
+
+void AtomicWriteT::Commit(void)
+{
+	Assert(Core.Descriptor() >= 0);
+	Core.Sync(true);
+	auto const &Name = Destination.Filename();
+	if (!Temporary)
+	{
+		// Give the unnamed file a temporary name, since linkat won't replace the destination
+		auto const Source = "/proc/self/fd/" + std::to_string(Core.Descriptor());
+		Temporary = Claim(Name, [&](std::string const &Candidate)
+			{ return linkat(AT_FDCWD, Source.c_str(), Directory, Candidate.c_str(), AT_SYMLINK_FOLLOW) == 0; });
+	}
+	if (renameat(Directory, Temporary->c_str(), Directory, Name.c_str()) != 0)
+		throw SYSTEM_ERROR << "Error replacing [" << Destination << "]: " << strerror(errno);
+	Temporary = {};
+	Core = RawFileT();
+	if (auto Cache = StatCacheT::Active()) Cache->Invalidate(Destination);
+	auto const Parent = Directory;
+	Directory = -1;
+	if (Group) Group->Add(Destination.Exit(), Parent);
+	else 
+	{
+		try { SyncDirectory(Destination.Exit(), Parent); }
+		catch (...)
+		{
+			close(Parent);
+			throw;
+		}
+		close(Parent);
+	}
+}
+
+void AtomicWriteT::Discard(void)
+{
+	if (Temporary) unlinkat(Directory, Temporary->c_str(), 0);
+	Temporary = {};
+	Core = RawFileT();
+	if (Directory >= 0) close(Directory);
+	Directory = -1;
+}
+
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef ren_cxx_filesystem__atomicwrite_h
+#define ren_cxx_filesystem__atomicwrite_h
+
+#include "path.h"
+#include "file.h"
+
+#ifndef _WIN32
+namespace Filesystem
+{
+
+// Directories whose fsync is deferred so many replacements can share one.  Replacements
+// added to a group are visible immediately but only durable once Commit returns.
+// Thread-safe.
+struct CommitGroupT
+{
+	CommitGroupT(void);
+	CommitGroupT(CommitGroupT const &Other) = delete;
+	CommitGroupT &operator =(CommitGroupT const &Other) = delete;
+	~CommitGroupT(void); // Commits, dropping errors
+
+	size_t Pending(void) const; // Directories waiting for a sync
+	void Commit(void); // Syncs every directory added since the last commit
+
+	private:
+		friend struct AtomicWriteT;
+		void Add(PathT const &Directory, int Descriptor); // Takes the descriptor
+
+		mutable std::mutex Mutex;
+		std::unordered_map<PathT, int> Directories;
+};
+
+// Replaces a file so that readers and crashes only ever see the old or the new contents.
+// Data goes to an unnamed O_TMPFILE where supported, otherwise to a hidden sibling file.
+// Commit syncs the data, renames it over the destination and syncs the directory (or
+// leaves that to Group).  Destroying an uncommitted write discards it.
+struct AtomicWriteT
+{
+	static AtomicWriteT Open(PathT const &Destination, int Mode = 0644, CommitGroupT *Group = nullptr);
+	static void Publish(PathT const &Destination, WriteSpanT const &Data, int Mode = 0644, CommitGroupT *Group = nullptr);
+
+	AtomicWriteT(AtomicWriteT &&Other);
+	AtomicWriteT(AtomicWriteT const &Other) = delete;
+	AtomicWriteT &operator =(AtomicWriteT &&Other) = delete;
+	AtomicWriteT &operator =(AtomicWriteT const &Other) = delete;
+	~AtomicWriteT(void);
+
+	RawFileT &File(void);
+	void Commit(void);
+
+	private:
+		AtomicWriteT(PathT const &Destination, CommitGroupT *Group);
+		std::string Claim(std::string const &Name, std::function<bool(std::string const &Candidate)> const &Create) const;
+		void Discard(void);
+
+		PathT Destination;
+		CommitGroupT *Group;
+		int Directory; // Destination's parent
+		OptionalT<std::string> Temporary; // Sibling name when not using O_TMPFILE
+		RawFileT Core;
+};
+
+}
+#endif
+
+#endif
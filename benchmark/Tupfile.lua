@@ -0,0 +1,11 @@
+DoOnce 'ren-cxx-filesystem/Tupfile.lua'
+
+for Index, Source in ipairs(tup.glob '*.cxx')
+do
+	Define.Executable
+	{
+		Name = tup.base(Source),
+		Sources = Item(Source),
+		Objects = FilesystemObjects,
+	}
+end
@@ -0,0 +1,435 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+
+#include "../path.h"
+#include "../file.h"
+#include "../snapshot.h"
+#include "../glob.h"
+#include "../hash.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// Usage: benchmark [--filter TEXT] [--min-time MS] [--samples N] [--tree-width N]
+//	[--tree-depth N] [--tree-files N] [--file-sizes N,N,...] [--quick]
+// Writes one JSON document to stdout.  Times are nanoseconds per operation.
+
+struct SettingsT
+{
+	std::string Filter;
+	double MinimumSeconds = 0.2;
+	size_t Samples = 5;
+	size_t TreeWidth = 4, TreeDepth = 4, TreeFiles = 16;
+	std::vector<size_t> FileSizes{4096, 1 << 20, 64 << 20};
+};
+
+template <typename ValueT> inline void Keep(ValueT const &Value)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "g"(&Value) : "memory");
+#else
+	static ValueT const *volatile Sink;
+	Sink = &Value;
+#endif
+}
+
+struct ResultT
+{
+	std::string Name;
+	size_t Operations;
+	std::vector<double> Nanoseconds; // Per operation, one per sample
+	size_t BytesPerOperation;
+};
+
+struct SuiteT
+{
+	SuiteT(SettingsT const &Settings) : Settings(Settings) { }
+
+	bool Wanted(std::string const &Name) const
+		{ return Settings.Filter.empty() || (Name.find(Settings.Filter) != std::string::npos); }
+
+	// Runs Body(Count) with growing counts until a sample takes MinimumSeconds
+	template <typename BodyT> void Micro(std::string const &Name, BodyT const &Body, size_t BytesPerOperation = 0)
+	{
+		if (!Wanted(Name)) return;
+		size_t Count = 1;
+		double Seconds = 0;
+		while (true)
+		{
+			Seconds = Time([&](void) { Body(Count); });
+			if (Seconds >= Settings.MinimumSeconds) break;
+			auto const Scale = (Seconds <= 0) ? 10.0 : std::min(10.0, 1.2 * Settings.MinimumSeconds / Seconds);
+			Count = std::max(Count + 1, static_cast<size_t>(Count * Scale));
+		}
+		ResultT Result{Name, Count, {Seconds * 1e9 / Count}, BytesPerOperation};
+		for (size_t Sample = 1; Sample < Settings.Samples; ++Sample)
+			Result.Nanoseconds.push_back(Time([&](void) { Body(Count); }) * 1e9 / Count);
+		Results.push_back(std::move(Result));
+	}
+
+	// Times Body once per sample; Prepare runs untimed before each
+	template <typename PrepareT, typename BodyT> void Macro(std::string const &Name, PrepareT const &Prepare, BodyT const &Body, size_t BytesPerOperation = 0)
+	{
+		if (!Wanted(Name)) return;
+		ResultT Result{Name, 1, {}, BytesPerOperation};
+		for (size_t Sample = 0; Sample < Settings.Samples; ++Sample)
+		{
+			Prepare();
+			Result.Nanoseconds.push_back(Time(Body) * 1e9);
+		}
+		Results.push_back(std::move(Result));
+	}
+
+	void Dump(std::ostream &Out) const
+	{
+		Out << "{\n\t\"settings\": {\"min_time_ms\": " << Settings.MinimumSeconds * 1000 <<
+			", \"samples\": " << Settings.Samples <<
+			", \"tree\": [" << Settings.TreeWidth << ", " << Settings.TreeDepth << ", " << Settings.TreeFiles << "]},\n";
+		Out << "\t\"results\": [";
+		bool First = true;
+		for (auto const &Result : Results)
+		{
+			auto Sorted = Result.Nanoseconds;
+			std::sort(Sorted.begin(), Sorted.end());
+			auto const Median = Sorted[Sorted.size() / 2];
+			Out << (First ? "\n" : ",\n") << std::fixed << std::setprecision(2) <<
+				"\t\t{\"name\": \"" << Result.Name << "\", " <<
+				"\"operations\": " << Result.Operations << ", " <<
+				"\"ns_median\": " << Median << ", " <<
+				"\"ns_min\": " << Sorted.front() << ", " <<
+				"\"ns_max\": " << Sorted.back();
+			if (Result.BytesPerOperation > 0)
+				Out << ", \"bytes\": " << Result.BytesPerOperation <<
+					", \"mb_per_second\": " << (Result.BytesPerOperation / (Median / 1e9)) / (1 << 20);
+			Out << "}";
+			First = false;
+		}
+		Out << "\n\t]\n}\n";
+	}
+
+	private:
+		template <typename BodyT> static double Time(BodyT const &Body)
+		{
+			auto const Start = std::chrono::steady_clock::now();
+			Body();
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+		}
+
+		SettingsT const &Settings;
+		std::vector<ResultT> Results;
+};
+
+static void BuildTree(Filesystem::PathT const &Root, SettingsT const &Settings, size_t Depth = 0)
+{
+	Assert(Root.CreateDirectory());
+	for (size_t File = 0; File < Settings.TreeFiles; ++File)
+		Filesystem::FileT::OpenWrite(Root.Enter("file" + std::to_string(File))).Write(std::string("data"));
+	if (Depth + 1 >= Settings.TreeDepth) return;
+	for (size_t Child = 0; Child < Settings.TreeWidth; ++Child)
+		BuildTree(Root.Enter("dir" + std::to_string(Child)), Settings, Depth + 1);
+}
+
+static size_t ListTree(Filesystem::PathT const &Root)
+{
+	size_t Count = 0;
+	Root.List([&](Filesystem::PathT &&Path, bool, bool IsDirectory)
+	{
+		++Count;
+		if (IsDirectory) Count += ListTree(Path);
+		return true;
+	});
+	return Count;
+}
+
+int main(int Count, char **Arguments)
+{
+	SettingsT Settings;
+	for (int Index = 1; Index < Count; ++Index)
+	{
+		std::string const Argument = Arguments[Index];
+		auto const Next = [&](void) -> std::string
+		{
+			if (Index + 1 >= Count)
+			{
+				std::cerr << "Missing value for " << Argument << std::endl;
+				exit(1);
+			}
+			return Arguments[++Index];
+		};
+		if (Argument == "--filter") Settings.Filter = Next();
+		else if (Argument == "--min-time") Settings.MinimumSeconds = std::stod(Next()) / 1000;
+		else if (Argument == "--samples") Settings.Samples = std::max(1ul, std::stoul(Next()));
+		else if (Argument == "--tree-width") Settings.TreeWidth = std::stoul(Next());
+		else if (Argument == "--tree-depth") Settings.TreeDepth = std::max(1ul, std::stoul(Next()));
+		else if (Argument == "--tree-files") Settings.TreeFiles = std::stoul(Next());
+		else if (Argument == "--file-sizes")
+		{
+			Settings.FileSizes.clear();
+			std::stringstream Sizes(Next());
+			std::string Size;
+			while (std::getline(Sizes, Size, ',')) Settings.FileSizes.push_back(std::stoul(Size));
+		}
+		else if (Argument == "--quick")
+		{
+			Settings.MinimumSeconds = 0.02;
+			Settings.Samples = 3;
+			Settings.TreeWidth = Settings.TreeDepth = 3;
+			Settings.TreeFiles = 4;
+			Settings.FileSizes = {4096, 1 << 20};
+		}
+		else
+		{
+			std::cerr << "Unknown argument " << Argument << std::endl;
+			return 1;
+		}
+	}
+
+	SuiteT Suite(Settings);
+
+	// Paths
+	{
+		auto const Root = Filesystem::PathT::Qualify("/");
+		std::string const Raw = "usr/local/share/doc/ren-cxx-filesystem/examples/benchmark.txt";
+		auto const Deep = Root.EnterRaw(Raw);
+		auto const Sibling = Root.EnterRaw("usr/local/share/doc/ren-cxx-filesystem/examples/other.txt");
+		auto const Directory = Deep.Exit();
+
+		Suite.Micro("path.enter_raw", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Root.EnterRaw(Raw));
+		});
+		Suite.Micro("path.enter", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Deep.Enter("child"));
+		});
+		Suite.Micro("path.render", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Deep.Render());
+		});
+		Suite.Micro("path.render_buffer", [&](size_t Count)
+		{
+			char Buffer[512];
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				Deep.Render(Buffer);
+				Keep(Buffer);
+			}
+		});
+		Suite.Micro("path.contains", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				Keep(Directory.Contains(Sibling));
+				Keep(Sibling.Contains(Deep));
+			}
+		});
+		{
+			auto const Glob = Filesystem::GlobT::Compile("{src,include}/**/*.{h,cxx}");
+			Suite.Micro("path.glob_match", [&](size_t Count)
+			{
+				for (size_t Index = 0; Index < Count; ++Index)
+				{
+					Keep(Glob.Match("src/a/b/c/file.cxx"));
+					Keep(Glob.Match("docs/a/b/c/file.cxx"));
+				}
+			});
+		}
+		Suite.Micro("path.refcount", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				Filesystem::PathT Copy(Deep);
+				Keep(Copy);
+			}
+		});
+		auto const Threads = std::max(2u, std::thread::hardware_concurrency());
+		Suite.Micro("path.refcount_contended", [&](size_t Count)
+		{
+			std::vector<std::thread> Workers;
+			for (size_t Thread = 0; Thread < Threads; ++Thread)
+				Workers.emplace_back([&](void)
+				{
+					for (size_t Index = 0; Index < Count / Threads + 1; ++Index)
+					{
+						Filesystem::PathT Copy(Deep);
+						Keep(Copy);
+					}
+				});
+			for (auto &Worker : Workers) Worker.join();
+		});
+	}
+
+	auto const Scratch = Filesystem::PathT::Temp(false);
+
+	// Trees
+	{
+		auto const Tree = Scratch.Enter("tree");
+		auto const Prepare = [&](void) { if (!Tree.Exists()) BuildTree(Tree, Settings); };
+		Suite.Macro("tree.list", Prepare, [&](void) { Keep(ListTree(Tree)); });
+		{
+			// One branch of many can match, so pruning skips the rest unlisted
+			auto const Pruned = Filesystem::GlobT::Compile("dir0/**/file1");
+			auto const Everywhere = Filesystem::GlobT::Compile("**/file1");
+			Suite.Macro("tree.glob_pruned", Prepare, [&](void)
+			{
+				size_t Count = 0;
+				Pruned.Walk(Tree, [&](Filesystem::PathT &&, bool, bool) { ++Count; return true; });
+				Keep(Count);
+			});
+			Suite.Macro("tree.glob", Prepare, [&](void)
+			{
+				size_t Count = 0;
+				Everywhere.Walk(Tree, [&](Filesystem::PathT &&, bool, bool) { ++Count; return true; });
+				Keep(Count);
+			});
+		}
+		Suite.Macro("tree.walk", Prepare, [&](void)
+		{
+			std::atomic<size_t> Count{0};
+			Filesystem::WalkT Walk;
+			Walk.Before = [&](Filesystem::PathT const &, bool, bool) { ++Count; return true; };
+			Tree.Walk(Walk);
+			Keep(Count);
+		});
+#ifndef _WIN32
+		Suite.Macro("tree.snapshot_scan", Prepare, [&](void) { Keep(Filesystem::SnapshotT::Scan(Tree).Count()); });
+		{
+			// Rescans only trust directories last modified well before the snapshot
+			OptionalT<Filesystem::SnapshotT> Base;
+			auto const PrepareBase = [&](void)
+			{
+				Prepare();
+				if (Base) return;
+				timespec const Times[2] = {{1000000000, 0}, {1000000000, 0}};
+				Filesystem::WalkT Walk;
+				Walk.Threads = 1;
+				Walk.After = [&](Filesystem::PathT const &Path) { utimensat(AT_FDCWD, Path.Render().c_str(), Times, 0); };
+				Tree.Walk(Walk);
+				Base = Filesystem::SnapshotT::Scan(Tree);
+			};
+			Suite.Macro("tree.snapshot_rescan", PrepareBase, [&](void)
+			{
+				Filesystem::SnapshotDiffT Diff;
+				Keep(Base->Rescan(Diff).Count());
+			});
+			Suite.Macro("tree.snapshot_rescan_trusted", PrepareBase, [&](void)
+			{
+				Filesystem::SnapshotDiffT Diff;
+				Keep(Base->Rescan(Diff, false).Count());
+			});
+		}
+#endif
+		Suite.Macro("tree.delete_directory", [&](void) { Tree.DeleteDirectory(); BuildTree(Tree, Settings); }, [&](void)
+		{
+			Assert(Tree.DeleteDirectory());
+		});
+		Tree.DeleteDirectory();
+	}
+
+	// Files
+	for (auto const Size : Settings.FileSizes)
+	{
+		auto const Path = Scratch.Enter("file" + std::to_string(Size));
+		{
+			std::string Data(Size, 0);
+			for (size_t Index = 0; Index < Size; ++Index) Data[Index] = static_cast<char>(Index * 31 + Index / 4096);
+			Filesystem::FileT::OpenWrite(Path).Write(Data);
+		}
+		auto const Suffix = "." + std::to_string(Size);
+		Suite.Micro("file.read_all" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::FileT::OpenRead(Path).ReadAll());
+		}, Size);
+		Suite.Micro("file.read_buffer" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				auto File = Filesystem::FileT::OpenRead(Path);
+				ReadBufferT Buffer(65536);
+				while (File.Read(Buffer)) Buffer.Consume(Buffer.Filled());
+			}
+		}, Size);
+#ifndef _WIN32
+		Suite.Micro("raw.read_all" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::RawFileT::OpenRead(Path).ReadAll());
+		}, Size);
+		Suite.Micro("raw.read_buffer" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				auto File = Filesystem::RawFileT::OpenRead(Path);
+				ReadBufferT Buffer(65536);
+				while (File.Read(Buffer)) Buffer.Consume(Buffer.Filled());
+			}
+		}, Size);
+#endif
+		Suite.Micro("mapped.read" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+			{
+				auto Mapped = Filesystem::MappedFileT::Open(Path);
+				uint64_t Sum = 0;
+				for (size_t Offset = 0; Offset + 8 <= Mapped.Size(); Offset += 8)
+				{
+					uint64_t Word;
+					memcpy(&Word, Mapped.Data() + Offset, 8);
+					Sum += Word;
+				}
+				Keep(Sum);
+			}
+		}, Size);
+		Suite.Micro("hash.fast" + Suffix, [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index)
+				Keep(Filesystem::HashFiles({Path}, Filesystem::HashSettingsT{})[0].Fast);
+		}, Size);
+		Suite.Micro("hash.strong" + Suffix, [&](size_t Count)
+		{
+			Filesystem::HashSettingsT Strong;
+			Strong.Strong = true;
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::HashFiles({Path}, Strong)[0].Fast);
+		}, Size);
+	}
+
+	// Many files hashed at once, spread over the pool
+	{
+		auto const Directory = Scratch.Enter("hashing");
+		Assert(Directory.CreateDirectory());
+		std::vector<Filesystem::PathT> Paths;
+		std::string const Data(1 << 16, 'x');
+		for (size_t Index = 0; Index < 256; ++Index)
+		{
+			Paths.push_back(Directory.Enter("file" + std::to_string(Index)));
+			Filesystem::FileT::OpenWrite(Paths.back()).Write(Data);
+		}
+		auto const Bytes = Paths.size() * Data.size();
+		Suite.Micro("hash.files_serial", [&](size_t Count)
+		{
+			Filesystem::HashSettingsT Serial;
+			Serial.Threads = 1;
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::HashFiles(Paths, Serial).size());
+		}, Bytes);
+		Suite.Micro("hash.files_parallel", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::HashFiles(Paths).size());
+		}, Bytes);
+		Suite.Micro("hash.find_duplicates", [&](size_t Count)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Keep(Filesystem::FindDuplicates(Paths).size());
+		}, Bytes);
+	}
+
+	Scratch.DeleteDirectory();
+	Suite.Dump(std::cout);
+	return 0;
+}
@@ -1,59 +1,229 @@
 #include "file.h"
+#include "instrument.h"
 
 #include <cstring>
+#include <algorithm>
 
-ReadBufferT::ReadBufferT(size_t Size) : 
-	Data(std::make_unique<uint8_t[]>(Size)),
-	Start(0), 
-	Stop(0), 
-	Total(Size)
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#else
+#include <io.h>
+#endif
+
+ReadBufferT::PoolT::PoolT(size_t BlockSize) : Block(BlockSize) { Assert(Block > 0); }
+
+ReadBufferT::PoolT::~PoolT(void) 
+{
+	for (auto Block : Spare) delete [] Block;
+}
+
+size_t ReadBufferT::PoolT::BlockSize(void) const { return Block; }
+
+uint8_t *ReadBufferT::PoolT::Take(void)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		if (!Spare.empty())
+		{
+			auto Out = Spare.back();
+			Spare.pop_back();
+			return Out;
+		}
+	}
+	return new uint8_t[Block];
+}
+
+void ReadBufferT::PoolT::Give(uint8_t *Block)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	Spare.push_back(Block);
+}
+
+ReadBufferT::ReadBufferT(StorageT Storage, uint8_t *Data, size_t Total, size_t Limit, PoolT *Pool) :
+	Storage(Storage),
+	Data(Data),
+	Start(0),
+	Stop(0),
+	Total(Total),
+	Maximum(Limit),
+	Pool(Pool)
+{
+}
+
+ReadBufferT::ReadBufferT(size_t Size, size_t Limit) : 
+	ReadBufferT(StorageT::Heap, nullptr, std::min(std::max(Size, size_t(1)), Limit), Limit, nullptr)
+{
+	Assert(Limit > 0);
+	Data = new uint8_t[Total];
+}
+
+ReadBufferT::ReadBufferT(PoolT &Pool, size_t Limit) :
+	ReadBufferT(StorageT::Pooled, Pool.Take(), std::min(Pool.BlockSize(), Limit), Limit, &Pool)
+{
+	Assert(Limit > 0);
+}
+
+ReadBufferT ReadBufferT::Ring(size_t Size)
+{
+#ifdef __linux__
+	size_t const Page = sysconf(_SC_PAGESIZE);
+	Size = std::max((Size + Page - 1) / Page * Page, Page);
+	auto const Descriptor = memfd_create("ReadBufferT", MFD_CLOEXEC);
+	if (Descriptor < 0)
+		throw SYSTEM_ERROR << "Unable to create ring buffer storage: " << strerror(errno);
+	if (ftruncate(Descriptor, Size) != 0)
+	{
+		auto const Error = errno;
+		close(Descriptor);
+		throw SYSTEM_ERROR << "Unable to size ring buffer storage: " << strerror(Error);
+	}
+	// Reserve both halves at once so nothing else can land between them
+	auto const Base = static_cast<uint8_t *>(mmap(nullptr, Size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (Base == MAP_FAILED)
+	{
+		auto const Error = errno;
+		close(Descriptor);
+		throw SYSTEM_ERROR << "Unable to reserve ring buffer: " << strerror(Error);
+	}
+	for (size_t Half = 0; Half < 2; ++Half)
+	{
+		if (mmap(Base + Size * Half, Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, Descriptor, 0) == MAP_FAILED)
+		{
+			auto const Error = errno;
+			munmap(Base, Size * 2);
+			close(Descriptor);
+			throw SYSTEM_ERROR << "Unable to map ring buffer: " << strerror(Error);
+		}
+	}
+	close(Descriptor);
+	return ReadBufferT(StorageT::Mapped, Base, Size, Size, nullptr);
+#else
+	return ReadBufferT(Size, Size);
+#endif
+}
+
+ReadBufferT::ReadBufferT(ReadBufferT &&Other) :
+	ReadBufferT(Other.Storage, Other.Data, Other.Total, Other.Maximum, Other.Pool)
+{
+	Start = Other.Start;
+	Stop = Other.Stop;
+	Other.Data = nullptr;
+	Other.Start = Other.Stop = Other.Total = 0;
+}
+
+ReadBufferT &ReadBufferT::operator =(ReadBufferT &&Other)
 {
+	if (this == &Other) return *this;
+	Release();
+	Storage = Other.Storage;
+	Data = Other.Data;
+	Start = Other.Start;
+	Stop = Other.Stop;
+	Total = Other.Total;
+	Maximum = Other.Maximum;
+	Pool = Other.Pool;
+	Other.Data = nullptr;
+	Other.Start = Other.Stop = Other.Total = 0;
+	return *this;
+}
+
+ReadBufferT::~ReadBufferT(void) { Release(); }
+
+void ReadBufferT::Release(void)
+{
+	if (!Data) return;
+	switch (Storage)
+	{
+		case StorageT::Heap: delete [] Data; break;
+		case StorageT::Pooled: Pool->Give(Data); break;
+		case StorageT::Mapped: 
+#ifndef _WIN32
+			munmap(Data, Total * 2); 
+#endif
+			break;
+	}
+	Data = nullptr;
 }
 
+size_t ReadBufferT::Capacity(void) const { return Total; }
+
+size_t ReadBufferT::Limit(void) const { return Maximum; }
+
 size_t ReadBufferT::Available(void) const
 {
+	if (Storage == StorageT::Mapped) return Total - Filled();
 	return Total - Stop;
 }
 	
 void ReadBufferT::Ensure(size_t NeededSize)
 {
+	if (Available() >= NeededSize) return;
+	Expand(NeededSize);
 	if (Available() < NeededSize)
-		Expand(NeededSize);
+		throw SYSTEM_ERROR << "Read buffer needs " << Filled() + NeededSize << " bytes, over its limit of " << Maximum;
 }
 
 void ReadBufferT::Expand(size_t AddSize)
 {
-	auto const OldStart = Start;
-	auto Potential = Start + (Total - Stop);
-	if (AddSize > Potential)
-	{
-		auto Difference = Potential - AddSize;
-		auto Replacement = std::make_unique<uint8_t[]>(Total + Difference * 2); // or something
-		memcpy(&Replacement[0], &Data[Start], Filled());
-		Data = std::move(Replacement);
-	}
-	else
+	if (Available() >= AddSize) return;
+	if (Storage != StorageT::Mapped)
 	{
-		memmove(&Data[0], &Data[Start], Filled());
+		auto const Used = Filled();
+		if ((Start >= Used) && (Total - Used >= AddSize))
+		{
+			// Copies no more than it frees, so compaction stays amortized O(1) per byte
+			memmove(Data, Data + Start, Used);
+			Start = 0;
+			Stop = Used;
+		}
+		else if (Total < Maximum)
+		{
+			auto const Wanted = (Used + AddSize < Used) ? Maximum : Used + AddSize; 
+			Reserve(std::min(std::max(Total * 2, Wanted), Maximum));
+		}
+		else if (Start > 0)
+		{
+			memmove(Data, Data + Start, Used);
+			Start = 0;
+			Stop = Used;
+		}
 	}
+	if (Available() == 0)
+		throw SYSTEM_ERROR << "Read buffer is full at its limit of " << Maximum << " bytes";
+}
+
+void ReadBufferT::Reserve(size_t Wanted)
+{
+	auto const Used = Filled();
+	auto Replacement = new uint8_t[Wanted];
+	memcpy(Replacement, Data + Start, Used);
+	Release();
+	Storage = StorageT::Heap;
+	Data = Replacement;
 	Start = 0;
-	Stop -= OldStart;
+	Stop = Used;
+	Total = Wanted;
 }
 
 uint8_t *ReadBufferT::EmptyStart(void)
 { 
-	return &Data[Stop]; 
+	return Data + Stop; 
 }
 
 uint8_t const *ReadBufferT::EmptyStart(void) const
 { 
-	return &Data[Stop]; 
+	return Data + Stop; 
 }
 
 void ReadBufferT::Fill(size_t FillSize)
 { 
+	AssertLTE(FillSize, Available()); 
 	Stop += FillSize; 
-	AssertLTE(Stop, Total); 
 }
 	
 size_t ReadBufferT::Filled(void) const
@@ -63,41 +233,51 @@ size_t ReadBufferT::Filled(void) const
 
 uint8_t *ReadBufferT::FilledStart(void)
 { 
-	return &Data[Start]; 
+	return Data + Start; 
 }
 
 uint8_t const *ReadBufferT::FilledStart(void) const
 { 
-	return &Data[Start]; 
+	return Data + Start; 
 }
 
 uint8_t *ReadBufferT::FilledStart(size_t RequiredSize, size_t Offset)
 {
-	auto OutStart = Start + Offset;
-	if (Stop - OutStart < RequiredSize) return nullptr;
-	return &Data[OutStart];
+	if ((Offset > Filled()) || (Filled() - Offset < RequiredSize)) return nullptr;
+	return Data + Start + Offset;
 }
 
 uint8_t const *ReadBufferT::FilledStart(size_t RequiredSize, size_t Offset) const
 {
-	auto OutStart = Start + Offset;
-	if (Stop - OutStart < RequiredSize) return nullptr;
-	return &Data[OutStart];
+	if ((Offset > Filled()) || (Filled() - Offset < RequiredSize)) return nullptr;
+	return Data + Start + Offset;
 }
 
 void ReadBufferT::Consume(size_t Size)
 { 
+	AssertLTE(Size, Filled()); 
 	Start += Size; 
-	AssertLTE(Start, Stop); 
+	if (Start == Stop) Start = Stop = 0; // Free compaction
+	else if (Start >= Total) // Ring: the second mapping is the first
+	{
+		Start -= Total;
+		Stop -= Total;
+	}
 }
 
 namespace Filesystem
 {
 
-FileT FileT::OpenRead(std::string const &Path) { return FileT(Path, fopen_read(Path)); }
-FileT FileT::OpenWrite(std::string const &Path) { return FileT(Path, fopen_write(Path)); }
-FileT FileT::OpenAppend(std::string const &Path) { return FileT(Path, fopen_append(Path)); }
-FileT FileT::OpenModify(std::string const &Path) { return FileT(Path, fopen_modify(Path)); }
+FileT FileT::OpenRead(std::string const &Path) { return FileT(Path, FILESYSTEM_TIMED(Open, fopen_read(Path))); }
+FileT FileT::OpenRead(std::string const &Path, AccessT Access) 
+{ 
+	auto Out = OpenRead(Path);
+	Out.Advise(Access);
+	return Out;
+}
+FileT FileT::OpenWrite(std::string const &Path) { return FileT(Path, FILESYSTEM_TIMED(Open, fopen_write(Path))); }
+FileT FileT::OpenAppend(std::string const &Path) { return FileT(Path, FILESYSTEM_TIMED(Open, fopen_append(Path))); }
+FileT FileT::OpenModify(std::string const &Path) { return FileT(Path, FILESYSTEM_TIMED(Open, fopen_modify(Path))); }
 
 FileT::FileT(void) : Core(nullptr) {}
 
@@ -125,7 +305,9 @@ FileT::operator bool(void) const
 void FileT::Write(std::vector<uint8_t> const &Data)
 {
 	Assert(Core);
-	auto Result = fwrite(&Data[0], Data.size(), 1, Core);
+	if (Data.empty()) return;
+	auto Result = FILESYSTEM_TIMED(Write, fwrite(Data.data(), Data.size(), 1, Core));
+	FILESYSTEM_COUNT(BytesWritten, Result * Data.size());
 	if ((Result == 0) && ferror(Core)) 
 		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
 }
@@ -133,21 +315,169 @@ void FileT::Write(std::vector<uint8_t> const &Data)
 void FileT::Write(std::string const &Data)
 {
 	Assert(Core);
-	auto Result = fwrite(Data.c_str(), Data.size(), 1, Core);
+	auto Result = FILESYSTEM_TIMED(Write, fwrite(Data.c_str(), Data.size(), 1, Core));
+	FILESYSTEM_COUNT(BytesWritten, Result * Data.size());
 	if ((Result == 0) && ferror(Core)) 
 		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
 }
 
+#ifndef _WIN32
+// Writes every span, retrying short writes; returns false with errno set on failure
+static bool WriteVector(int Descriptor, WriteSpanT const *Spans, size_t Count)
+{
+	size_t const BatchSize = std::min(64, IOV_MAX);
+	iovec Batch[64];
+	size_t Next = 0;
+	while (Next < Count)
+	{
+		size_t Used = 0;
+		for (; (Next < Count) && (Used < BatchSize); ++Next)
+		{
+			if (Spans[Next].Size == 0) continue;
+			Batch[Used].iov_base = const_cast<void *>(Spans[Next].Data);
+			Batch[Used].iov_len = Spans[Next].Size;
+			++Used;
+		}
+		auto Vector = Batch;
+		while (Used > 0)
+		{
+			auto Result = FILESYSTEM_TIMED(Write, ::writev(Descriptor, Vector, Used));
+			if (Result < 0)
+			{
+				if (errno == EINTR) continue;
+				return false;
+			}
+			FILESYSTEM_COUNT(BytesWritten, Result);
+			while ((Used > 0) && (static_cast<size_t>(Result) >= Vector->iov_len))
+			{
+				Result -= Vector->iov_len;
+				++Vector;
+				--Used;
+			}
+			if (Used > 0)
+			{
+				Vector->iov_base = static_cast<uint8_t *>(Vector->iov_base) + Result;
+				Vector->iov_len -= Result;
+			}
+		}
+	}
+	return true;
+}
+#endif
+
+#ifndef _WIN32
+static bool PreallocateDescriptor(int Descriptor, std::string const &Path, uint64_t Offset, uint64_t Length, bool KeepSize)
+{
+	if (Length == 0) return true;
+#ifdef __linux__
+	while (FILESYSTEM_TIMED(Hint, fallocate(Descriptor, KeepSize ? FALLOC_FL_KEEP_SIZE : 0, Offset, Length)) != 0)
+	{
+		if (errno == EINTR) continue;
+		if ((errno == EOPNOTSUPP) || (errno == ENOSYS)) return false;
+		throw SYSTEM_ERROR << "Error preallocating [" << Path << "]: " << strerror(errno);
+	}
+	return true;
+#else
+	// posix_fallocate may emulate by writing zeros, which is no help and sets the size
+	if (KeepSize) return false;
+	auto const Error = FILESYSTEM_TIMED(Hint, posix_fallocate(Descriptor, Offset, Length));
+	if ((Error == EOPNOTSUPP) || (Error == EINVAL)) return false;
+	if (Error != 0) throw SYSTEM_ERROR << "Error preallocating [" << Path << "]: " << strerror(Error);
+	return true;
+#endif
+}
+
+static bool AdviseDescriptor(int Descriptor, AccessT Access, uint64_t Offset, uint64_t Length)
+{
+#ifdef POSIX_FADV_NORMAL
+	int Advice = POSIX_FADV_NORMAL;
+	switch (Access)
+	{
+		case AccessT::Normal: Advice = POSIX_FADV_NORMAL; break;
+		case AccessT::Sequential: Advice = POSIX_FADV_SEQUENTIAL; break;
+		case AccessT::Random: Advice = POSIX_FADV_RANDOM; break;
+		case AccessT::WillNeed: Advice = POSIX_FADV_WILLNEED; break;
+		case AccessT::DontNeed: Advice = POSIX_FADV_DONTNEED; break;
+		case AccessT::NoReuse: Advice = POSIX_FADV_NOREUSE; break;
+	}
+	return FILESYSTEM_TIMED(Hint, posix_fadvise(Descriptor, Offset, Length, Advice)) == 0;
+#else
+	return false;
+#endif
+}
+
+static bool ReadaheadDescriptor(int Descriptor, uint64_t Offset, uint64_t Length)
+{
+#ifdef __linux__
+	return FILESYSTEM_TIMED(Hint, readahead(Descriptor, Offset, Length)) == 0;
+#else
+	return AdviseDescriptor(Descriptor, AccessT::WillNeed, Offset, Length);
+#endif
+}
+
+static void SyncRangeDescriptor(int Descriptor, std::string const &Path, uint64_t Offset, uint64_t Length, bool Wait)
+{
+#ifdef __linux__
+	unsigned int const Flags = Wait ?
+		SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER :
+		SYNC_FILE_RANGE_WRITE;
+	while (FILESYSTEM_TIMED(Sync, sync_file_range(Descriptor, Offset, Length, Flags)) != 0)
+	{
+		if (errno == EINTR) continue;
+		throw SYSTEM_ERROR << "Error syncing [" << Path << "]: " << strerror(errno);
+	}
+#else
+	if (!Wait) return;
+	while (FILESYSTEM_TIMED(Sync, fdatasync(Descriptor)) != 0)
+	{
+		if (errno == EINTR) continue;
+		throw SYSTEM_ERROR << "Error syncing [" << Path << "]: " << strerror(errno);
+	}
+#endif
+}
+#endif
+
+void FileT::Write(WriteSpanT const *Spans, size_t Count)
+{
+	Assert(Core);
+	size_t Total = 0;
+	for (size_t Index = 0; Index < Count; ++Index) Total += Spans[Index].Size;
+#ifndef _WIN32
+	if (Total >= BUFSIZ)
+	{
+		if ((fflush(Core) != 0) || !WriteVector(fileno(Core), Spans, Count))
+			throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+		return;
+	}
+#endif
+	// Small batches are cheaper to combine in the stdio buffer than to send as a syscall
+	for (size_t Index = 0; Index < Count; ++Index)
+	{
+		if (Spans[Index].Size == 0) continue;
+		if (FILESYSTEM_TIMED(Write, fwrite(Spans[Index].Data, Spans[Index].Size, 1, Core)) != 1)
+			throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+		FILESYSTEM_COUNT(BytesWritten, Spans[Index].Size);
+	}
+}
+
+void FileT::Write(std::initializer_list<WriteSpanT> Spans) { Write(Spans.begin(), Spans.size()); }
+
 bool FileT::Read(std::vector<uint8_t> &Buffer)
 {
 	Assert(Core);
 	if (!*this) return false;
 	if (Buffer.empty()) Buffer.resize(4096);
-	auto Result = fread(&Buffer[0], 1, Buffer.size(), Core); // TODO handle errors
+	Buffer.resize(ReadSome(&Buffer[0], Buffer.size()));
+	return true;
+}
+
+size_t FileT::ReadSome(void *Data, size_t Size)
+{
+	auto const Result = FILESYSTEM_TIMED(Read, fread(Data, 1, Size, Core));
 	if ((Result == 0) && ferror(Core)) 
 		throw SYSTEM_ERROR << "Error reading from [" << Path << "]: " << strerror(errno);
-	Buffer.resize(Result);
-	return true;
+	FILESYSTEM_COUNT(BytesRead, Result);
+	return Result;
 }
 	
 std::vector<uint8_t> FileT::ReadAll(void)
@@ -160,19 +490,88 @@ std::vector<uint8_t> FileT::ReadAll(void)
 FileT &FileT::Seek(size_t Offset) 
 { 
 	Assert(Core);
-	fseek(Core, Offset, SEEK_SET); 
+#ifdef _WIN32
+	if (FILESYSTEM_TIMED(Seek, _fseeki64(Core, Offset, SEEK_SET)) != 0)
+#else
+	if (FILESYSTEM_TIMED(Seek, fseeko(Core, Offset, SEEK_SET)) != 0)
+#endif
+		throw SYSTEM_ERROR << "Error seeking in [" << Path << "]: " << strerror(errno);
 	return *this;
 }
 
 size_t FileT::Tell(void) const
 {
 	Assert(Core);
-	return ftell(Core);
+#ifdef _WIN32
+	auto const Out = _ftelli64(Core);
+#else
+	auto const Out = ftello(Core);
+#endif
+	if (Out < 0) throw SYSTEM_ERROR << "Error getting position in [" << Path << "]: " << strerror(errno);
+	return Out;
+}
+
+void FileT::Sync(void)
+{
+	Assert(Core);
+	FILESYSTEM_TIME(Sync);
+#ifdef _WIN32
+	if ((fflush(Core) != 0) || (_commit(_fileno(Core)) != 0))
+#else
+	if ((fflush(Core) != 0) || (fsync(fileno(Core)) != 0))
+#endif
+		throw SYSTEM_ERROR << "Error syncing [" << Path << "]: " << strerror(errno);
+}
+
+bool FileT::Preallocate(uint64_t Offset, uint64_t Length, bool KeepSize)
+{
+	Assert(Core);
+#ifdef _WIN32
+	return false;
+#else
+	if (fflush(Core) != 0)
+		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+	return PreallocateDescriptor(fileno(Core), Path, Offset, Length, KeepSize);
+#endif
+}
+
+bool FileT::Advise(AccessT Access, uint64_t Offset, uint64_t Length)
+{
+	Assert(Core);
+#ifdef _WIN32
+	return false;
+#else
+	return AdviseDescriptor(fileno(Core), Access, Offset, Length);
+#endif
+}
+
+bool FileT::Readahead(uint64_t Offset, uint64_t Length)
+{
+	Assert(Core);
+#ifdef _WIN32
+	return false;
+#else
+	return ReadaheadDescriptor(fileno(Core), Offset, Length);
+#endif
+}
+
+void FileT::SyncRange(uint64_t Offset, uint64_t Length, bool Wait)
+{
+	Assert(Core);
+#ifdef _WIN32
+	if (Wait) Sync();
+	else if (fflush(Core) != 0)
+		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+#else
+	if (fflush(Core) != 0)
+		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+	SyncRangeDescriptor(fileno(Core), Path, Offset, Length, Wait);
+#endif
 }
 
 FileT::~FileT(void) 
 { 
-	if (Core) fclose(Core); 
+	if (Core) FILESYSTEM_TIMED(Close, fclose(Core)); 
 }
 
 FileT::FileT(std::string const &Path, FILE *Core) : Path(Path), Core(Core) 
@@ -181,5 +580,399 @@ FileT::FileT(std::string const &Path, FILE *Core) : Path(Path), Core(Core)
 		throw CONSTRUCTION_ERROR << "Unable to open file [" << Path << "]";
 }
 
+#ifndef _WIN32
+static int OpenRaw(std::string const &Path, int Flags)
+	{ return FILESYSTEM_TIMED(Open, open(Path.c_str(), Flags | O_CLOEXEC, 0666)); }
+
+RawFileT RawFileT::OpenRead(std::string const &Path) { return RawFileT(Path, OpenRaw(Path, O_RDONLY)); }
+RawFileT RawFileT::OpenRead(std::string const &Path, AccessT Access) 
+{ 
+	auto Out = OpenRead(Path);
+	Out.Advise(Access);
+	return Out;
+}
+
+RawFileT RawFileT::OpenWrite(std::string const &Path) { return RawFileT(Path, OpenRaw(Path, O_WRONLY | O_CREAT | O_TRUNC)); }
+RawFileT RawFileT::OpenAppend(std::string const &Path) { return RawFileT(Path, OpenRaw(Path, O_WRONLY | O_CREAT | O_APPEND)); }
+RawFileT RawFileT::OpenModify(std::string const &Path) { return RawFileT(Path, OpenRaw(Path, O_RDWR)); }
+RawFileT RawFileT::Adopt(std::string const &Path, int Descriptor) { return RawFileT(Path, Descriptor); }
+
+RawFileT::RawFileT(void) : Core(-1), Ended(false) {}
+
+RawFileT::RawFileT(RawFileT &&Other) : Path(std::move(Other.Path)), Core(Other.Core), Ended(Other.Ended)
+{
+	Other.Core = -1;
+}
+
+RawFileT &RawFileT::operator =(RawFileT &&Other)
+{
+	if (&Other == this) return *this;
+	if (Core >= 0) FILESYSTEM_TIMED(Close, close(Core));
+	Path = std::move(Other.Path);
+	Core = Other.Core;
+	Ended = Other.Ended;
+	Other.Core = -1;
+	return *this;
+}
+
+RawFileT::~RawFileT(void)
+{
+	if (Core >= 0) FILESYSTEM_TIMED(Close, close(Core));
+}
+
+RawFileT::operator bool(void) const { return (Core >= 0) && !Ended; }
+
+int RawFileT::Descriptor(void) const { return Core; }
+
+int RawFileT::Release(void)
+{
+	auto const Out = Core;
+	Core = -1;
+	return Out;
+}
+
+std::string const &RawFileT::Name(void) const { return Path; }
+
+void RawFileT::Write(void const *Data, size_t Size)
+{
+	Assert(Core >= 0);
+	auto Cursor = static_cast<uint8_t const *>(Data);
+	while (Size > 0)
+	{
+		auto const Result = FILESYSTEM_TIMED(Write, ::write(Core, Cursor, Size));
+		if (Result < 0)
+		{
+			if (errno == EINTR) continue;
+			throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+		}
+		FILESYSTEM_COUNT(BytesWritten, Result);
+		Cursor += Result;
+		Size -= Result;
+	}
+}
+
+void RawFileT::Write(std::vector<uint8_t> const &Data) { Write(Data.data(), Data.size()); }
+
+void RawFileT::Write(std::string const &Data) { Write(Data.data(), Data.size()); }
+
+void RawFileT::Write(WriteSpanT const *Spans, size_t Count)
+{
+	Assert(Core >= 0);
+	if (!WriteVector(Core, Spans, Count))
+		throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+}
+
+void RawFileT::Write(std::initializer_list<WriteSpanT> Spans) { Write(Spans.begin(), Spans.size()); }
+
+size_t RawFileT::Read(void *Data, size_t Size)
+{
+	Assert(Core >= 0);
+	while (true)
+	{
+		auto const Result = FILESYSTEM_TIMED(Read, ::read(Core, Data, Size));
+		if (Result < 0)
+		{
+			if (errno == EINTR) continue;
+			throw SYSTEM_ERROR << "Error reading from [" << Path << "]: " << strerror(errno);
+		}
+		FILESYSTEM_COUNT(BytesRead, Result);
+		if ((Result == 0) && (Size > 0)) Ended = true;
+		return Result;
+	}
+}
+
+bool RawFileT::Read(std::vector<uint8_t> &Buffer)
+{
+	if (!*this) return false;
+	if (Buffer.empty()) Buffer.resize(4096);
+	Buffer.resize(Read(Buffer.data(), Buffer.size()));
+	return true;
+}
+
+BytesT RawFileT::ReadAll(void)
+{
+	// Read straight into the result, sized from the file when it has a size
+	BytesT Out;
+	struct stat StatResultBuffer;
+	if ((fstat(Core, &StatResultBuffer) == 0) && S_ISREG(StatResultBuffer.st_mode))
+		Out.reserve(StatResultBuffer.st_size + 1);
+	size_t Filled = 0;
+	while (true)
+	{
+		if (Out.capacity() - Filled == 0) Out.reserve(std::max<size_t>(4096, Out.capacity() * 2));
+		Out.resize(Out.capacity());
+		auto const Result = Read(Out.data() + Filled, Out.size() - Filled);
+		Filled += Result;
+		if (Result == 0) break;
+	}
+	Out.resize(Filled);
+	return Out;
+}
+
+size_t RawFileT::ReadAt(uint64_t Offset, void *Data, size_t Size) const
+{
+	Assert(Core >= 0);
+	auto Cursor = static_cast<uint8_t *>(Data);
+	size_t Total = 0;
+	while (Total < Size)
+	{
+		auto const Result = FILESYSTEM_TIMED(Read, ::pread(Core, Cursor + Total, Size - Total, Offset + Total));
+		if (Result < 0)
+		{
+			if (errno == EINTR) continue;
+			throw SYSTEM_ERROR << "Error reading from [" << Path << "]: " << strerror(errno);
+		}
+		FILESYSTEM_COUNT(BytesRead, Result);
+		if (Result == 0) break;
+		Total += Result;
+	}
+	return Total;
+}
+
+void RawFileT::WriteAt(uint64_t Offset, void const *Data, size_t Size) const
+{
+	Assert(Core >= 0);
+	auto Cursor = static_cast<uint8_t const *>(Data);
+	while (Size > 0)
+	{
+		auto const Result = FILESYSTEM_TIMED(Write, ::pwrite(Core, Cursor, Size, Offset));
+		if (Result < 0)
+		{
+			if (errno == EINTR) continue;
+			throw SYSTEM_ERROR << "Error writing to [" << Path << "]: " << strerror(errno);
+		}
+		FILESYSTEM_COUNT(BytesWritten, Result);
+		Cursor += Result;
+		Offset += Result;
+		Size -= Result;
+	}
+}
+
+RawFileT &RawFileT::Seek(uint64_t Offset)
+{
+	Assert(Core >= 0);
+	if (lseek(Core, Offset, SEEK_SET) < 0)
+		throw SYSTEM_ERROR << "Error seeking in [" << Path << "]: " << strerror(errno);
+	Ended = false;
+	return *this;
+}
+
+uint64_t RawFileT::Tell(void) const
+{
+	Assert(Core >= 0);
+	auto const Out = lseek(Core, 0, SEEK_CUR);
+	if (Out < 0) throw SYSTEM_ERROR << "Error getting position in [" << Path << "]: " << strerror(errno);
+	return Out;
+}
+
+uint64_t RawFileT::Size(void) const
+{
+	Assert(Core >= 0);
+	struct stat StatResultBuffer;
+	if (fstat(Core, &StatResultBuffer) != 0)
+		throw SYSTEM_ERROR << "Error getting size of [" << Path << "]: " << strerror(errno);
+	return StatResultBuffer.st_size;
+}
+
+void RawFileT::Sync(bool DataOnly) const
+{
+	Assert(Core >= 0);
+	while (true)
+	{
+		if (FILESYSTEM_TIMED(Sync, DataOnly ? fdatasync(Core) : fsync(Core)) == 0) return;
+		if (errno == EINTR) continue;
+		throw SYSTEM_ERROR << "Error syncing [" << Path << "]: " << strerror(errno);
+	}
+}
+
+bool RawFileT::Preallocate(uint64_t Offset, uint64_t Length, bool KeepSize)
+{
+	Assert(Core >= 0);
+	return PreallocateDescriptor(Core, Path, Offset, Length, KeepSize);
+}
+
+bool RawFileT::Advise(AccessT Access, uint64_t Offset, uint64_t Length)
+{
+	Assert(Core >= 0);
+	return AdviseDescriptor(Core, Access, Offset, Length);
+}
+
+bool RawFileT::Readahead(uint64_t Offset, uint64_t Length)
+{
+	Assert(Core >= 0);
+	return ReadaheadDescriptor(Core, Offset, Length);
+}
+
+void RawFileT::SyncRange(uint64_t Offset, uint64_t Length, bool Wait)
+{
+	Assert(Core >= 0);
+	SyncRangeDescriptor(Core, Path, Offset, Length, Wait);
+}
+
+RawFileT::RawFileT(std::string const &Path, int Core) : Path(Path), Core(Core), Ended(false)
+{
+	if (Core < 0)
+		throw CONSTRUCTION_ERROR << "Unable to open file [" << Path << "]";
+}
+
+WriteCombinerT::WriteCombinerT(RawFileT &File, size_t Threshold) : File(File), Threshold(Threshold) 
+{ 
+	Buffer.reserve(Threshold); 
 }
 
+WriteCombinerT::~WriteCombinerT(void) 
+{ 
+	try { Flush(); } 
+	catch (...) { }
+}
+
+size_t WriteCombinerT::Pending(void) const { return Buffer.size(); }
+
+void WriteCombinerT::Write(void const *Data, size_t Size) { Write({WriteSpanT(Data, Size)}); }
+
+void WriteCombinerT::Write(WriteSpanT const *Spans, size_t Count)
+{
+	size_t Total = Buffer.size();
+	for (size_t Index = 0; Index < Count; ++Index) Total += Spans[Index].Size;
+	if (Total < Threshold)
+	{
+		for (size_t Index = 0; Index < Count; ++Index)
+		{
+			auto const Data = static_cast<uint8_t const *>(Spans[Index].Data);
+			Buffer.insert(Buffer.end(), Data, Data + Spans[Index].Size);
+		}
+		return;
+	}
+	if (Buffer.empty()) File.Write(Spans, Count);
+	else
+	{
+		std::vector<WriteSpanT> Combined;
+		Combined.reserve(Count + 1);
+		Combined.emplace_back(Buffer);
+		Combined.insert(Combined.end(), Spans, Spans + Count);
+		Send(Combined.data(), Combined.size());
+	}
+}
+
+void WriteCombinerT::Write(std::initializer_list<WriteSpanT> Spans) { Write(Spans.begin(), Spans.size()); }
+
+void WriteCombinerT::Flush(void)
+{
+	if (Buffer.empty()) return;
+	WriteSpanT const Pending(Buffer);
+	Send(&Pending, 1);
+}
+
+void WriteCombinerT::Send(WriteSpanT const *Spans, size_t Count)
+{
+	// Nothing is retried after an error, so the pending bytes are dropped either way
+	try { File.Write(Spans, Count); }
+	catch (...) 
+	{
+		Buffer.clear();
+		throw;
+	}
+	Buffer.clear();
+}
+#endif
+
+MappedFileT MappedFileT::Open(std::string const &Path)
+{
+	MappedFileT Out;
+	Out.Path = Path;
+#ifndef _WIN32
+	auto const Descriptor = FILESYSTEM_TIMED(Open, open(Path.c_str(), O_RDONLY | O_CLOEXEC));
+	if (Descriptor < 0) 
+		throw CONSTRUCTION_ERROR << "Unable to open file [" << Path << "]: " << strerror(errno);
+	struct stat StatResultBuffer;
+	if ((fstat(Descriptor, &StatResultBuffer) == 0) && 
+		S_ISREG(StatResultBuffer.st_mode) && 
+		(StatResultBuffer.st_size > 0) && 
+		(static_cast<uint64_t>(StatResultBuffer.st_size) <= SIZE_MAX))
+	{
+		auto const Size = static_cast<size_t>(StatResultBuffer.st_size);
+		auto const Mapping = FILESYSTEM_TIMED(Map, mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Descriptor, 0));
+		if (Mapping != MAP_FAILED)
+		{
+			Out.Start = static_cast<uint8_t const *>(Mapping);
+			Out.Length = Size;
+			Out.IsMapped = true;
+		}
+	}
+	close(Descriptor);
+	if (Out.IsMapped) return Out;
+#endif
+	Out.Fallback = FileT::OpenRead(Path).ReadAll();
+	Out.Start = Out.Fallback.data();
+	Out.Length = Out.Fallback.size();
+	return Out;
+}
+
+MappedFileT::MappedFileT(void) : Start(nullptr), Length(0), IsMapped(false) {}
+
+MappedFileT::MappedFileT(MappedFileT &&Other) : 
+	Path(std::move(Other.Path)), 
+	Start(Other.Start), 
+	Length(Other.Length), 
+	IsMapped(Other.IsMapped), 
+	Fallback(std::move(Other.Fallback))
+{
+	Other.Start = nullptr;
+	Other.Length = 0;
+	Other.IsMapped = false;
+}
+
+MappedFileT &MappedFileT::operator =(MappedFileT &&Other)
+{
+	if (&Other == this) return *this;
+	Unmap();
+	Path = std::move(Other.Path);
+	Start = Other.Start;
+	Length = Other.Length;
+	IsMapped = Other.IsMapped;
+	Fallback = std::move(Other.Fallback);
+	Other.Start = nullptr;
+	Other.Length = 0;
+	Other.IsMapped = false;
+	return *this;
+}
+
+MappedFileT::~MappedFileT(void) { Unmap(); }
+
+uint8_t const *MappedFileT::Data(void) const { return Start; }
+
+size_t MappedFileT::Size(void) const { return Length; }
+
+bool MappedFileT::Mapped(void) const { return IsMapped; }
+
+void MappedFileT::AdviseSequential(void)
+{
+#ifndef _WIN32
+	if (IsMapped) madvise(const_cast<uint8_t *>(Start), Length, MADV_SEQUENTIAL);
+#endif
+}
+
+void MappedFileT::AdviseWillNeed(size_t Offset, size_t Length)
+{
+#ifndef _WIN32
+	if (!IsMapped || (Offset >= this->Length)) return;
+	Length = std::min(Length, this->Length - Offset);
+	// madvise needs a page-aligned start
+	auto const Page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	auto const Aligned = Offset / Page * Page;
+	madvise(const_cast<uint8_t *>(Start) + Aligned, Length + (Offset - Aligned), MADV_WILLNEED);
+#endif
+}
+
+void MappedFileT::Unmap(void)
+{
+#ifndef _WIN32
+	if (IsMapped) munmap(const_cast<uint8_t *>(Start), Length);
+#endif
+	IsMapped = false;
+	Start = nullptr;
+	Length = 0;
+	Fallback.clear();
+}
+
+}
@@ -5,6 +5,10 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <initializer_list>
 
 #include "../ren-cxx-basics/extrastandard.h"
 #include "../ren-cxx-basics/error.h"
@@ -29,14 +33,61 @@ inline FILE *fopen_append(std::string const &Filename)
 	{ return ::fopen(Filename.c_str(), "a"); }
 #endif
 
+// Constructs elements without arguments by default-initializing them, so resizing a
+// vector of bytes leaves the new ones as they are instead of zeroing them first
+template <typename ValueT> struct DefaultInitAllocatorT : std::allocator<ValueT>
+{
+	template <typename OtherT> struct rebind { using other = DefaultInitAllocatorT<OtherT>; };
+
+	DefaultInitAllocatorT(void) = default;
+	template <typename OtherT> DefaultInitAllocatorT(DefaultInitAllocatorT<OtherT> const &) noexcept {}
+
+	template <typename OtherT> void construct(OtherT *Pointer) { ::new (static_cast<void *>(Pointer)) OtherT; }
+	template <typename OtherT, typename ...ArgumentsT> void construct(OtherT *Pointer, ArgumentsT &&...Arguments)
+		{ ::new (static_cast<void *>(Pointer)) OtherT(std::forward<ArgumentsT>(Arguments)...); }
+};
+
+using BytesT = std::vector<uint8_t, DefaultInitAllocatorT<uint8_t>>;
+
+// Filled bytes are always contiguous at FilledStart.  Linear buffers grow geometrically up
+// to Limit, compacting only when that frees at least as much space as it copies.  Ring
+// buffers map their storage twice back to back, so wrapping never needs a copy, but their
+// capacity is fixed.
 struct ReadBufferT
 {
-	ReadBufferT(size_t Size = 4096);
+	// Fixed-size blocks shared between buffers; must outlive the buffers using it
+	struct PoolT
+	{
+		PoolT(size_t BlockSize = 65536);
+		~PoolT(void);
+		size_t BlockSize(void) const;
+
+		private:
+			friend struct ReadBufferT;
+			uint8_t *Take(void);
+			void Give(uint8_t *Block);
+
+			size_t const Block;
+			std::mutex Mutex;
+			std::vector<uint8_t *> Spare;
+	};
+
+	ReadBufferT(size_t Size = 4096, size_t Limit = SIZE_MAX);
+	ReadBufferT(PoolT &Pool, size_t Limit = SIZE_MAX); // Starts in a pool block, returned when outgrown
+	static ReadBufferT Ring(size_t Size); // Size is rounded up to the page size
+	ReadBufferT(ReadBufferT &&Other);
+	ReadBufferT(ReadBufferT const &Other) = delete;
+	ReadBufferT &operator =(ReadBufferT &&Other);
+	ReadBufferT &operator =(ReadBufferT const &Other) = delete;
+	~ReadBufferT(void);
+
+	size_t Capacity(void) const;
+	size_t Limit(void) const;
 
 	// Filling
 	size_t Available(void) const;
-	void Ensure(size_t NeededSize);
-	void Expand(size_t AddSize);
+	void Ensure(size_t NeededSize); // Throws if NeededSize can't be made available
+	void Expand(size_t AddSize); // Makes up to AddSize available, as the limit allows; throws if full
 	uint8_t *EmptyStart(void);
 	uint8_t const *EmptyStart(void) const;
 	void Fill(size_t);
@@ -50,16 +101,39 @@ struct ReadBufferT
 	void Consume(size_t ReduceSize);
 
 	private:
-		std::unique_ptr<uint8_t[]> Data;
-		size_t Start, Stop, Total;
+		enum struct StorageT { Heap, Pooled, Mapped };
+		ReadBufferT(StorageT Storage, uint8_t *Data, size_t Total, size_t Limit, PoolT *Pool);
+		void Release(void);
+		void Reserve(size_t Wanted);
+
+		StorageT Storage;
+		uint8_t *Data;
+		size_t Start, Stop, Total, Maximum;
+		PoolT *Pool;
 };
 
 namespace Filesystem
 {
 
+// One piece of a scatter-gather write; doesn't own Data
+struct WriteSpanT
+{
+	WriteSpanT(void const *Data, size_t Size) : Data(Data), Size(Size) { }
+	WriteSpanT(std::string const &Data) : Data(Data.data()), Size(Data.size()) { }
+	WriteSpanT(std::string_view const &Data) : Data(Data.data()), Size(Data.size()) { }
+	WriteSpanT(std::vector<uint8_t> const &Data) : Data(Data.data()), Size(Data.size()) { }
+
+	void const *Data;
+	size_t Size;
+};
+
+// How a file's data will be used, for the kernel's caching and readahead
+enum struct AccessT { Normal, Sequential, Random, WillNeed, DontNeed, NoReuse };
+
 struct FileT
 {
 	static FileT OpenRead(std::string const &Path);
+	static FileT OpenRead(std::string const &Path, AccessT Access); // Advises for the whole file
 	static FileT OpenWrite(std::string const &Path);
 	static FileT OpenAppend(std::string const &Path);
 	static FileT OpenModify(std::string const &Path);
@@ -73,6 +147,8 @@ struct FileT
 	operator bool(void) const;
 	void Write(std::vector<uint8_t> const &Data);
 	void Write(std::string const &Data);
+	void Write(WriteSpanT const *Spans, size_t Count); // Large batches bypass the stdio buffer
+	void Write(std::initializer_list<WriteSpanT> Spans);
 	bool Read(std::vector<uint8_t> &Buffer);
 	template <typename BufferT> bool Read(BufferT &Buffer)
 	{
@@ -81,24 +157,147 @@ struct FileT
 		if (!*this) return false;
 		if (Buffer.Available() < 4096)
 			Buffer.Expand(4096);
-		auto ReadSize = fread(Buffer.EmptyStart(), 1, Buffer.Available(), Core);
-		if ((ReadSize == 0) && ferror(Core)) 
-			throw SYSTEM_ERROR << "Error reading from [" << Path << "]: " << strerror(errno);
-		Buffer.Fill(ReadSize);
+		Buffer.Fill(ReadSome(Buffer.EmptyStart(), Buffer.Available()));
 		return true;
 	}
 	std::vector<uint8_t> ReadAll(void);
 	FileT &Seek(size_t Offset);
 	size_t Tell(void) const;
+	void Sync(void); // Flushes stdio, then fsyncs
+
+	// Hints return false where unsupported.  For Advise and SyncRange, Length 0 means to the end.
+	bool Preallocate(uint64_t Offset, uint64_t Length, bool KeepSize = false); // Reserves extents; throws if out of space
+	bool Advise(AccessT Access, uint64_t Offset = 0, uint64_t Length = 0);
+	bool Readahead(uint64_t Offset, uint64_t Length); // Starts reading into the page cache
+	void SyncRange(uint64_t Offset, uint64_t Length, bool Wait = false); // Starts (or waits for) writeback of written data
 
 	~FileT(void);
 
 	private:
 		FileT(std::string const &File, FILE *Core);
+		size_t ReadSome(void *Data, size_t Size); // Throws on error, 0 at the end
 		std::string Path;
 		FILE *Core;
 };
 
+#ifndef _WIN32
+// Unbuffered file on a raw descriptor.  Reads land directly in the caller's buffer.
+// ReadAt and WriteAt neither use nor move the file offset, so threads can share one file.
+struct RawFileT
+{
+	static RawFileT OpenRead(std::string const &Path);
+	static RawFileT OpenRead(std::string const &Path, AccessT Access); // Advises for the whole file
+	static RawFileT OpenWrite(std::string const &Path);
+	static RawFileT OpenAppend(std::string const &Path);
+	static RawFileT OpenModify(std::string const &Path);
+	static RawFileT Adopt(std::string const &Path, int Descriptor); // Closes Descriptor when done
+
+	RawFileT(void);
+	RawFileT(RawFileT &&Other);
+	RawFileT(RawFileT const &Other) = delete;
+	RawFileT &operator =(RawFileT &&Other);
+	RawFileT &operator =(RawFileT const &Other) = delete;
+	~RawFileT(void);
+
+	operator bool(void) const; // False once a read reaches the end
+	int Descriptor(void) const;
+	int Release(void); // Gives up the descriptor without closing it
+	std::string const &Name(void) const;
+
+	void Write(void const *Data, size_t Size);
+	void Write(std::vector<uint8_t> const &Data);
+	void Write(std::string const &Data);
+	void Write(WriteSpanT const *Spans, size_t Count); // One writev per batch of spans
+	void Write(std::initializer_list<WriteSpanT> Spans);
+	size_t Read(void *Data, size_t Size); // Returns 0 at the end
+	bool Read(std::vector<uint8_t> &Buffer);
+	template <typename BufferT> bool Read(BufferT &Buffer)
+	{
+		// BufferT must provide the methods in ReadBufferT above
+		if (!*this) return false;
+		if (Buffer.Available() < 4096)
+			Buffer.Expand(4096);
+		Buffer.Fill(Read(Buffer.EmptyStart(), Buffer.Available()));
+		return true;
+	}
+	BytesT ReadAll(void); // Reads straight into the result, which isn't zeroed first
+
+	size_t ReadAt(uint64_t Offset, void *Data, size_t Size) const; // Short only at the end
+	void WriteAt(uint64_t Offset, void const *Data, size_t Size) const;
+
+	RawFileT &Seek(uint64_t Offset);
+	uint64_t Tell(void) const;
+	uint64_t Size(void) const;
+	void Sync(bool DataOnly = false) const; // fsync, or fdatasync when DataOnly
+
+	// As in FileT
+	bool Preallocate(uint64_t Offset, uint64_t Length, bool KeepSize = false);
+	bool Advise(AccessT Access, uint64_t Offset = 0, uint64_t Length = 0);
+	bool Readahead(uint64_t Offset, uint64_t Length);
+	void SyncRange(uint64_t Offset, uint64_t Length, bool Wait = false);
+
+	private:
+		RawFileT(std::string const &Path, int Core);
+		std::string Path;
+		int Core;
+		bool Ended;
+};
+
+// Collects small writes and passes them to File once Threshold bytes are pending.  A
+// write that would cross the threshold goes out with the pending bytes in one writev,
+// without being copied.  Flush to see errors; the destructor flushes but drops them.
+struct WriteCombinerT
+{
+	WriteCombinerT(RawFileT &File, size_t Threshold = 65536);
+	WriteCombinerT(WriteCombinerT const &Other) = delete;
+	WriteCombinerT &operator =(WriteCombinerT const &Other) = delete;
+	~WriteCombinerT(void);
+
+	size_t Pending(void) const;
+	void Write(void const *Data, size_t Size);
+	void Write(WriteSpanT const *Spans, size_t Count);
+	void Write(std::initializer_list<WriteSpanT> Spans);
+	void Flush(void);
+
+	private:
+		void Send(WriteSpanT const *Spans, size_t Count); // Writes, then empties Buffer
+
+		RawFileT &File;
+		size_t const Threshold;
+		std::vector<uint8_t> Buffer;
+};
+#endif
+
+// Read-only view of a whole file, mapped when possible.  Files that can't be mapped
+// (pipes, some virtual files, Windows) are read into memory instead.
+struct MappedFileT
+{
+	static MappedFileT Open(std::string const &Path);
+
+	MappedFileT(void);
+	MappedFileT(MappedFileT &&Other);
+	MappedFileT(MappedFileT const &Other) = delete;
+	MappedFileT &operator =(MappedFileT &&Other);
+	MappedFileT &operator =(MappedFileT const &Other) = delete;
+	~MappedFileT(void);
+
+	uint8_t const *Data(void) const;
+	size_t Size(void) const;
+	bool Mapped(void) const;
+
+	// Hints, no effect when not mapped
+	void AdviseSequential(void);
+	void AdviseWillNeed(size_t Offset = 0, size_t Length = SIZE_MAX);
+
+	private:
+		void Unmap(void);
+		std::string Path;
+		uint8_t const *Start;
+		size_t Length;
+		bool IsMapped;
+		std::vector<uint8_t> Fallback;
+};
+
 }
 
 #endif
@@ -0,0 +1,328 @@
+#include "glob.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+static size_t const MaximumAlternatives = 65536;
+
+// Index just past the class starting at Start, which is a '['
+static size_t SkipClass(std::string const &Pattern, size_t Start)
+{
+	auto Index = Start + 1;
+	if ((Index < Pattern.size()) && ((Pattern[Index] == '!') || (Pattern[Index] == '^'))) ++Index;
+	if ((Index < Pattern.size()) && (Pattern[Index] == ']')) ++Index;
+	for (; Index < Pattern.size(); ++Index)
+	{
+		if (Pattern[Index] == '\\') ++Index;
+		else if (Pattern[Index] == ']') return Index + 1;
+	}
+	throw CONSTRUCTION_ERROR << "Unclosed character class in glob [" << Pattern << "]";
+}
+
+// Expands the first top-level brace group, recursively, leaving escapes in place
+static void ExpandBraces(std::string const &Pattern, std::vector<std::string> &Out)
+{
+	size_t Open = std::string::npos;
+	std::vector<size_t> Commas;
+	size_t Depth = 0;
+	for (size_t Index = 0; Index < Pattern.size(); ++Index)
+	{
+		auto const Character = Pattern[Index];
+		if (Character == '\\') ++Index;
+		else if (Character == '[') Index = SkipClass(Pattern, Index) - 1;
+		else if (Character == '{')
+		{
+			if (Depth++ == 0) Open = Index;
+		}
+		else if ((Character == ',') && (Depth == 1)) Commas.push_back(Index);
+		else if ((Character == '}') && (Depth > 0) && (--Depth == 0))
+		{
+			auto const Prefix = Pattern.substr(0, Open);
+			auto const Suffix = Pattern.substr(Index + 1);
+			Commas.push_back(Index);
+			size_t Begin = Open + 1;
+			for (auto const End : Commas)
+			{
+				ExpandBraces(Prefix + Pattern.substr(Begin, End - Begin) + Suffix, Out);
+				if (Out.size() > MaximumAlternatives)
+					throw CONSTRUCTION_ERROR << "Glob [" << Pattern << "] has too many alternatives";
+				Begin = End + 1;
+			}
+			return;
+		}
+	}
+	if (Depth > 0) throw CONSTRUCTION_ERROR << "Unclosed brace in glob [" << Pattern << "]";
+	Out.push_back(Pattern);
+}
+
+GlobT::GlobT(void) {}
+
+GlobT GlobT::Compile(std::string const &Pattern)
+{
+	GlobT Out;
+	Out.Source = Pattern;
+	std::vector<std::string> Alternatives;
+	ExpandBraces(Pattern, Alternatives);
+	std::sort(Alternatives.begin(), Alternatives.end());
+	Alternatives.erase(std::unique(Alternatives.begin(), Alternatives.end()), Alternatives.end());
+	for (auto const &Alternative : Alternatives)
+	{
+		Out.Start.push_back(static_cast<uint32_t>(Out.States.size()));
+		Out.AddAlternative(Alternative);
+	}
+	Out.Close(Out.Start);
+	return Out;
+}
+
+void GlobT::AddAlternative(std::string const &Alternative)
+{
+	size_t Index = 0;
+	while (Index <= Alternative.size())
+	{
+		// One segment, up to an unescaped separator
+		StateT State;
+		State.Kind = StateT::KindT::Literal;
+		std::string Raw;
+		for (; (Index < Alternative.size()) && (Alternative[Index] != '/'); ++Index)
+		{
+			auto const Character = Alternative[Index];
+			if ((Character == '\\') && (Index + 1 < Alternative.size()))
+			{
+				++Index;
+				State.Literal.push_back(Alternative[Index]);
+				State.Tokens.push_back({TokenT::KindT::Character, static_cast<uint8_t>(Alternative[Index]), 0});
+			}
+			else if (Character == '?')
+			{
+				State.Kind = StateT::KindT::Wildcard;
+				State.Tokens.push_back({TokenT::KindT::Any, 0, 0});
+			}
+			else if (Character == '*')
+			{
+				State.Kind = StateT::KindT::Wildcard;
+				// Runs of stars are one star
+				if (State.Tokens.empty() || (State.Tokens.back().Kind != TokenT::KindT::Star))
+					State.Tokens.push_back({TokenT::KindT::Star, 0, 0});
+			}
+			else if (Character == '[')
+			{
+				State.Kind = StateT::KindT::Wildcard;
+				auto const End = SkipClass(Alternative, Index) - 1;
+				std::bitset<256> Members;
+				auto Member = Index + 1;
+				bool const Negated = (Alternative[Member] == '!') || (Alternative[Member] == '^');
+				if (Negated) ++Member;
+				// A leading ] was skipped over by SkipClass, so it lands here as a member
+				for (; Member < End; ++Member)
+				{
+					auto Low = static_cast<uint8_t>(Alternative[Member]);
+					if ((Low == '\\') && (Member + 1 < End)) Low = static_cast<uint8_t>(Alternative[++Member]);
+					auto High = Low;
+					if ((Member + 2 < End) && (Alternative[Member + 1] == '-'))
+					{
+						Member += 2;
+						High = static_cast<uint8_t>(Alternative[Member]);
+						if ((High == '\\') && (Member + 1 < End)) High = static_cast<uint8_t>(Alternative[++Member]);
+					}
+					for (unsigned Value = Low; Value <= High; ++Value) Members.set(Value);
+				}
+				if (Negated) Members.flip();
+				Members.reset('/');
+				State.Tokens.push_back({TokenT::KindT::Class, 0, static_cast<uint32_t>(Classes.size())});
+				Classes.push_back(Members);
+				Index = End;
+			}
+			else
+			{
+				State.Literal.push_back(Character);
+				State.Tokens.push_back({TokenT::KindT::Character, static_cast<uint8_t>(Character), 0});
+			}
+			Raw.push_back(Character);
+		}
+		++Index;
+
+		if (Raw.empty()) continue; // Separators at the ends or doubled
+		if (Raw == "**")
+		{
+			State.Kind = StateT::KindT::Globstar;
+			State.Tokens.clear();
+			// Consecutive globstars are one globstar
+			if (!States.empty() && (States.back().Kind == StateT::KindT::Globstar) && (States.size() > Start.back())) continue;
+		}
+		if (State.Kind == StateT::KindT::Literal) State.Tokens.clear();
+		else State.Literal.clear();
+		States.push_back(std::move(State));
+	}
+	States.push_back({StateT::KindT::Accept, {}, {}});
+}
+
+void GlobT::Close(SetT &Set) const
+{
+	for (size_t Index = 0; Index < Set.size(); ++Index)
+		if (States[Set[Index]].Kind == StateT::KindT::Globstar) Set.push_back(Set[Index] + 1);
+	std::sort(Set.begin(), Set.end());
+	Set.erase(std::unique(Set.begin(), Set.end()), Set.end());
+}
+
+GlobT::SetT GlobT::Step(SetT const &Set, std::string_view Name) const
+{
+	SetT Out;
+	for (auto const Index : Set)
+	{
+		auto const &State = States[Index];
+		switch (State.Kind)
+		{
+			case StateT::KindT::Literal: if (Name == State.Literal) Out.push_back(Index + 1); break;
+			case StateT::KindT::Wildcard: if (MatchSegment(State, Name)) Out.push_back(Index + 1); break;
+			case StateT::KindT::Globstar: Out.push_back(Index); break;
+			case StateT::KindT::Accept: break;
+		}
+	}
+	Close(Out);
+	return Out;
+}
+
+bool GlobT::Accepts(SetT const &Set) const
+{
+	for (auto const Index : Set) if (States[Index].Kind == StateT::KindT::Accept) return true;
+	return false;
+}
+
+bool GlobT::Live(SetT const &Set) const
+{
+	for (auto const Index : Set) if (States[Index].Kind != StateT::KindT::Accept) return true;
+	return false;
+}
+
+bool GlobT::MatchSegment(StateT const &State, std::string_view Name) const
+{
+	// Greedy with one backtrack point: a later star subsumes any earlier one's choices
+	auto const &Tokens = State.Tokens;
+	size_t Token = 0, Position = 0;
+	size_t StarToken = SIZE_MAX, StarPosition = 0;
+	while (Position < Name.size())
+	{
+		if (Token < Tokens.size())
+		{
+			auto const &Current = Tokens[Token];
+			auto const Character = static_cast<uint8_t>(Name[Position]);
+			if (Current.Kind == TokenT::KindT::Star)
+			{
+				StarToken = Token++;
+				StarPosition = Position;
+				continue;
+			}
+			if ((Current.Kind == TokenT::KindT::Any) ||
+				((Current.Kind == TokenT::KindT::Character) && (Current.Character == Character)) ||
+				((Current.Kind == TokenT::KindT::Class) && Classes[Current.Class][Character]))
+			{
+				++Token;
+				++Position;
+				continue;
+			}
+		}
+		if (StarToken == SIZE_MAX) return false;
+		Token = StarToken + 1;
+		Position = ++StarPosition;
+	}
+	while ((Token < Tokens.size()) && (Tokens[Token].Kind == TokenT::KindT::Star)) ++Token;
+	return Token == Tokens.size();
+}
+
+std::string const &GlobT::Pattern(void) const { return Source; }
+
+bool GlobT::Match(std::string_view Relative) const
+{
+	auto Set = Start;
+	while (!Relative.empty() && !Set.empty())
+	{
+		auto const Separator = Relative.find('/');
+		auto const Name = Relative.substr(0, Separator);
+		Relative = (Separator == std::string_view::npos) ? std::string_view() : Relative.substr(Separator + 1);
+		if (Name.empty()) continue;
+		Set = Step(Set, Name);
+	}
+	return Accepts(Set);
+}
+
+bool GlobT::Match(PathT const &Base, PathT const &Path) const
+{
+	if ((Path.Depth() <= Base.Depth()) || !Base.Contains(Path)) return false;
+	std::vector<std::string> Names;
+	for (PathT At = Path; At.Depth() > Base.Depth(); At = At.Exit()) Names.push_back(At.Filename());
+	auto Set = Start;
+	for (auto Name = Names.rbegin(); (Name != Names.rend()) && !Set.empty(); ++Name) Set = Step(Set, *Name);
+	return Accepts(Set);
+}
+
+bool GlobT::Walk(PathT const &Base, std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const
+{
+	bool Stopped = false;
+	return WalkDirectory(Base, Start, Callback, Stopped) && !Stopped;
+}
+
+bool GlobT::WalkDirectory(
+	PathT const &Directory,
+	SetT const &Set,
+	std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback,
+	bool &Stopped) const
+{
+	std::vector<std::tuple<PathT, bool, bool>> Entries;
+	bool Listed = true;
+	bool const Plain = std::all_of(Set.begin(), Set.end(), [&](uint32_t Index)
+	{
+		auto const Kind = States[Index].Kind;
+		return (Kind == StateT::KindT::Literal) || (Kind == StateT::KindT::Accept);
+	});
+	if (Plain)
+	{
+		std::vector<std::string const *> Names;
+		for (auto const Index : Set)
+			if (States[Index].Kind == StateT::KindT::Literal) Names.push_back(&States[Index].Literal);
+		std::sort(Names.begin(), Names.end(), [](auto First, auto Second) { return *First < *Second; });
+		Names.erase(std::unique(Names.begin(), Names.end(), [](auto First, auto Second) { return *First == *Second; }), Names.end());
+		for (auto const Name : Names)
+		{
+			auto Path = Directory.Enter(*Name);
+			auto const Stat = Path.Stat();
+			if (!Stat) continue;
+			Entries.emplace_back(std::move(Path), Stat->Type == EntryTypeT::File, Stat->Type == EntryTypeT::Directory);
+		}
+	}
+	else
+	{
+		Listed = Directory.List([&](PathT &&Path, bool IsFile, bool IsDir)
+		{
+			Entries.emplace_back(std::move(Path), IsFile, IsDir);
+			return true;
+		});
+		std::sort(Entries.begin(), Entries.end(), [](auto const &First, auto const &Second)
+			{ return std::get<0>(First).Filename() < std::get<0>(Second).Filename(); });
+	}
+
+	for (auto &Entry : Entries)
+	{
+		auto const &Path = std::get<0>(Entry);
+		auto const IsDir = std::get<2>(Entry);
+		auto const Next = Step(Set, Path.Filename());
+		if (Next.empty()) continue;
+		if (Accepts(Next) && !Callback(PathT(Path), std::get<1>(Entry), IsDir))
+		{
+			Stopped = true;
+			return false;
+		}
+		if (IsDir && Live(Next))
+		{
+			Listed = WalkDirectory(Path, Next, Callback, Stopped) && Listed;
+			if (Stopped) return false;
+		}
+	}
+	return Listed;
+}
+
+}
@@ -0,0 +1,75 @@
+#ifndef ren_cxx_filesystem__glob_h
+#define ren_cxx_filesystem__glob_h
+
+#include "path.h"
+
+#include <bitset>
+#include <vector>
+
+namespace Filesystem
+{
+
+// A glob compiled into an automaton over path segments.  Patterns are relative to a base
+// and '/'-separated:
+//	*	any run of characters within a name
+//	?	any one character
+//	[a-z]	a character class; [!a-z] or [^a-z] negates, and a leading ] is literal
+//	**	as a whole segment, any number of directories, including none
+//	{a,b}	alternatives, which may nest and contain separators
+//	\x	x literally
+// Wildcards match names starting with a dot.  Compile throws on unclosed classes or braces.
+struct GlobT
+{
+	static GlobT Compile(std::string const &Pattern);
+
+	std::string const &Pattern(void) const;
+
+	bool Match(std::string_view Relative) const; // A '/'-separated path relative to the base
+	bool Match(PathT const &Base, PathT const &Path) const; // False unless Path is below Base
+
+	// Calls back with matches below Base in name order, like List, listing only directories
+	// some match could be in.  Where every pattern has a plain name next, that name is
+	// looked up instead of listing, following links; links found by listing aren't
+	// descended.  False if a directory couldn't be listed or Callback returned false.
+	bool Walk(PathT const &Base, std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const;
+
+	private:
+		struct TokenT
+		{
+			enum struct KindT { Character, Any, Star, Class } Kind;
+			uint8_t Character;
+			uint32_t Class;
+		};
+
+		struct StateT
+		{
+			enum struct KindT { Literal, Wildcard, Globstar, Accept } Kind;
+			std::string Literal;
+			std::vector<TokenT> Tokens;
+		};
+
+		// Sorted state indices; state N moves to N + 1 on a matching segment
+		using SetT = std::vector<uint32_t>;
+
+		GlobT(void);
+		void AddAlternative(std::string const &Alternative);
+		void Close(SetT &States) const; // Adds what globstars can skip to
+		SetT Step(SetT const &States, std::string_view Name) const;
+		bool Accepts(SetT const &States) const;
+		bool Live(SetT const &States) const; // Whether anything deeper could match
+		bool MatchSegment(StateT const &State, std::string_view Name) const;
+		bool WalkDirectory(
+			PathT const &Directory,
+			SetT const &States,
+			std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback,
+			bool &Stopped) const;
+
+		std::string Source;
+		std::vector<StateT> States;
+		std::vector<std::bitset<256>> Classes;
+		SetT Start;
+};
+
+}
+
+#endif
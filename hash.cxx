@@ -0,0 +1,629 @@
+#include "hash.h"
+
+#include "file.h"
+#include "pool.h"
+
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <tuple>
+#include <unordered_set>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILESYSTEM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+// Fast hash
+
+static uint64_t const Initial[8] = {
+	0x2CB0F69F4ABEA221ULL, 0x9417034723148989ULL, 0xDD555950609DFE03ULL, 0xDBAFB150DEB12801ULL,
+	0x7E789B2E6C442CB7ULL, 0xF41E5636C7E4F8C5ULL, 0x0959D150F8FBA7E5ULL, 0xA97316F13CDB9EEBULL};
+static size_t const StripeSize = 64;
+static size_t const StripesPerBlock = 16;
+// Stripe N of a block is keyed by Keys[N] to Keys[N + 7], so moving a stripe changes the hash
+static uint64_t const Keys[StripesPerBlock + 7] = {
+	0x74CD8258F9520069ULL, 0x55C74A62E116868BULL, 0xD2F4C799A2023CBDULL, 0xDF98CB79A37B51B9ULL,
+	0x396F5885524F3905ULL, 0xAF1D56386CA3B277ULL, 0xA9FFBE6B5104E85BULL, 0x6BD0C51B9FD533B3ULL,
+	0xD77342894E171D35ULL, 0x86546BB4FD5CD630ULL, 0x271697C9FBBB3A07ULL, 0xC4B5A238D99CA99EULL,
+	0xDD2218B3EFD109B8ULL, 0xF1EECEEAB1D893ACULL, 0x6CD502746DC24446ULL, 0x2F416F9FAF62326CULL,
+	0x8BA8167C6B9B0ED2ULL, 0x0FC18BAFCF756AC1ULL, 0x9CB88E24782223A8ULL, 0xA0841AA454D23504ULL,
+	0x7CA224A1A7C38A48ULL, 0xC1EA9103BE02B4DBULL, 0x675368DDFE04FFA9ULL};
+static uint64_t const ScrambleKeys[8] = {
+	0x980CE91C50AB4B57ULL, 0x28AC395780FE62C5ULL, 0x768912E3A6BCEDC7ULL, 0x50B3E8C9332C7C89ULL,
+	0xCE3BBFE520BD47DBULL, 0xCBA6C8E8E0BB7C4FULL, 0xBF194DB8434A346DULL, 0x7D8F2A7B60416D7FULL};
+static uint64_t const FinalKeys[8] = {
+	0x0849D1F6E0E10A5FULL, 0x7654B590D064E22FULL, 0x16D1DA9507DF3AF3ULL, 0xF63AEF1089EA30E5ULL,
+	0x9ADE6673CC6C522BULL, 0x4C75BC274E37087DULL, 0xD35E12B49F51F27BULL, 0x22DDF2FFCEE481EBULL};
+static uint64_t const Prime32 = 0x9E3779B1ULL;
+
+// Little endian everywhere, so hashes don't depend on the machine
+static inline uint64_t Load64(uint8_t const *Data)
+{
+	uint64_t Out;
+	memcpy(&Out, Data, sizeof(Out));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	Out = __builtin_bswap64(Out);
+#endif
+	return Out;
+}
+
+static inline void Stripe(uint64_t *Lanes, uint8_t const *Data, size_t Index)
+{
+	for (size_t Lane = 0; Lane < 8; ++Lane)
+	{
+		auto const Value = Load64(Data + Lane * 8);
+		auto const Keyed = Value ^ Keys[Index + Lane];
+		Lanes[Lane ^ 1] += Value;
+		Lanes[Lane] += (Keyed & 0xFFFFFFFFULL) * (Keyed >> 32);
+	}
+}
+
+static inline void Scramble(uint64_t *Lanes)
+{
+	for (size_t Lane = 0; Lane < 8; ++Lane)
+	{
+		Lanes[Lane] ^= Lanes[Lane] >> 47;
+		Lanes[Lane] ^= ScrambleKeys[Lane];
+		Lanes[Lane] *= Prime32;
+	}
+}
+
+static inline uint64_t Mix(uint64_t First, uint64_t Second)
+{
+#ifdef __SIZEOF_INT128__
+	auto const Product = static_cast<unsigned __int128>(First) * Second;
+	return static_cast<uint64_t>(Product) ^ static_cast<uint64_t>(Product >> 64);
+#else
+	uint64_t const FirstLow = First & 0xFFFFFFFFULL, FirstHigh = First >> 32;
+	uint64_t const SecondLow = Second & 0xFFFFFFFFULL, SecondHigh = Second >> 32;
+	uint64_t const LowLow = FirstLow * SecondLow, HighLow = FirstHigh * SecondLow;
+	uint64_t const LowHigh = FirstLow * SecondHigh, HighHigh = FirstHigh * SecondHigh;
+	uint64_t const Cross = (LowLow >> 32) + (HighLow & 0xFFFFFFFFULL) + LowHigh;
+	uint64_t const High = HighHigh + (HighLow >> 32) + (Cross >> 32);
+	uint64_t const Low = (Cross << 32) | (LowLow & 0xFFFFFFFFULL);
+	return Low ^ High;
+#endif
+}
+
+typedef void BlocksT(uint64_t *Lanes, uint8_t const *Data, size_t Blocks);
+
+static void BlocksScalar(uint64_t *Lanes, uint8_t const *Data, size_t Blocks)
+{
+	for (size_t Block = 0; Block < Blocks; ++Block)
+	{
+		for (size_t Index = 0; Index < StripesPerBlock; ++Index, Data += StripeSize) Stripe(Lanes, Data, Index);
+		Scramble(Lanes);
+	}
+}
+
+#ifdef FILESYSTEM_X86_KERNELS
+__attribute__((target("avx2")))
+static inline __m256i AccumulateAVX2(__m256i Lanes, __m256i Value, __m256i Keys)
+{
+	auto const Keyed = _mm256_xor_si256(Value, Keys);
+	// Swapping neighbouring lanes adds each value to the other lane of its pair
+	Lanes = _mm256_add_epi64(Lanes, _mm256_shuffle_epi32(Value, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm256_add_epi64(Lanes, _mm256_mul_epu32(Keyed, _mm256_srli_epi64(Keyed, 32)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ScrambleAVX2(__m256i Lanes, __m256i Keys, __m256i Prime)
+{
+	Lanes = _mm256_xor_si256(Lanes, _mm256_srli_epi64(Lanes, 47));
+	Lanes = _mm256_xor_si256(Lanes, Keys);
+	// 64 by 32 bit multiply from two 32 by 32 bit ones
+	auto const Low = _mm256_mul_epu32(Lanes, Prime);
+	auto const High = _mm256_mul_epu32(_mm256_srli_epi64(Lanes, 32), Prime);
+	return _mm256_add_epi64(Low, _mm256_slli_epi64(High, 32));
+}
+
+__attribute__((target("avx2")))
+static void BlocksAVX2(uint64_t *Lanes, uint8_t const *Data, size_t Blocks)
+{
+	auto First = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Lanes));
+	auto Second = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Lanes + 4));
+	auto const FirstScramble = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ScrambleKeys));
+	auto const SecondScramble = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ScrambleKeys + 4));
+	auto const Prime = _mm256_set1_epi64x(static_cast<long long>(Prime32));
+	for (size_t Block = 0; Block < Blocks; ++Block)
+	{
+		for (size_t Index = 0; Index < StripesPerBlock; ++Index, Data += StripeSize)
+		{
+			auto const FirstKeys = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Keys + Index));
+			auto const SecondKeys = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Keys + Index + 4));
+			First = AccumulateAVX2(First, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Data)), FirstKeys);
+			Second = AccumulateAVX2(Second, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(Data + 32)), SecondKeys);
+		}
+		First = ScrambleAVX2(First, FirstScramble, Prime);
+		Second = ScrambleAVX2(Second, SecondScramble, Prime);
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(Lanes), First);
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(Lanes + 4), Second);
+}
+#endif
+
+static std::pair<BlocksT *, char const *> SelectKernel(void)
+{
+#ifdef FILESYSTEM_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return {BlocksAVX2, "avx2"};
+#endif
+	return {BlocksScalar, "scalar"};
+}
+
+// Chosen on first use, so hashing from other static initializers is safe
+static std::pair<BlocksT *, char const *> const &Kernel(void)
+{
+	static auto const Selected = SelectKernel();
+	return Selected;
+}
+
+char const *HashKernel(void) { return Kernel().second; }
+
+FastHasherT::FastHasherT(uint64_t Seed) : Seed(Seed)
+{
+	for (size_t Lane = 0; Lane < 8; ++Lane) Lanes[Lane] = Initial[Lane] ^ Seed;
+}
+
+void FastHasherT::Update(void const *Data, size_t Size)
+{
+	auto Bytes = static_cast<uint8_t const *>(Data);
+	Total += Size;
+	if (PendingSize > 0)
+	{
+		auto const Take = std::min(Size, BlockSize - PendingSize);
+		memcpy(Pending + PendingSize, Bytes, Take);
+		PendingSize += Take;
+		Bytes += Take;
+		Size -= Take;
+		if (PendingSize < BlockSize) return;
+		Kernel().first(Lanes, Pending, 1);
+		PendingSize = 0;
+	}
+	auto const Blocks = Size / BlockSize;
+	if (Blocks > 0)
+	{
+		Kernel().first(Lanes, Bytes, Blocks);
+		Bytes += Blocks * BlockSize;
+		Size -= Blocks * BlockSize;
+	}
+	if (Size > 0) memcpy(Pending, Bytes, Size);
+	PendingSize = Size;
+}
+
+uint64_t FastHasherT::Finish(void) const
+{
+	uint64_t Final[8];
+	memcpy(Final, Lanes, sizeof(Final));
+	size_t Offset = 0;
+	for (; Offset + StripeSize <= PendingSize; Offset += StripeSize) Stripe(Final, Pending + Offset, Offset / StripeSize);
+	if (Offset < PendingSize)
+	{
+		// Zero padding is unambiguous since the length goes in below
+		uint8_t Last[StripeSize] = {};
+		memcpy(Last, Pending + Offset, PendingSize - Offset);
+		Stripe(Final, Last, Offset / StripeSize);
+	}
+	uint64_t Out = (Total * 0x9E3779B185EBCA87ULL) ^ Seed;
+	for (size_t Lane = 0; Lane < 8; Lane += 2)
+		Out += Mix(Final[Lane] ^ FinalKeys[Lane], Final[Lane + 1] ^ FinalKeys[Lane + 1]);
+	Out ^= Out >> 37;
+	Out *= 0x165667919E3779F9ULL;
+	Out ^= Out >> 32;
+	return Out;
+}
+
+uint64_t FastHash(void const *Data, size_t Size, uint64_t Seed)
+{
+	FastHasherT Hasher(Seed);
+	Hasher.Update(Data, Size);
+	return Hasher.Finish();
+}
+
+// SHA-256
+
+static uint32_t const RoundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t Rotate(uint32_t Value, unsigned Count) { return (Value >> Count) | (Value << (32 - Count)); }
+
+static void Compress(uint32_t *State, uint8_t const *Block)
+{
+	uint32_t Schedule[64];
+	for (size_t Index = 0; Index < 16; ++Index)
+		Schedule[Index] =
+			(static_cast<uint32_t>(Block[Index * 4]) << 24) |
+			(static_cast<uint32_t>(Block[Index * 4 + 1]) << 16) |
+			(static_cast<uint32_t>(Block[Index * 4 + 2]) << 8) |
+			static_cast<uint32_t>(Block[Index * 4 + 3]);
+	for (size_t Index = 16; Index < 64; ++Index)
+	{
+		auto const Low = Schedule[Index - 15], High = Schedule[Index - 2];
+		Schedule[Index] = Schedule[Index - 16] + Schedule[Index - 7] +
+			(Rotate(Low, 7) ^ Rotate(Low, 18) ^ (Low >> 3)) +
+			(Rotate(High, 17) ^ Rotate(High, 19) ^ (High >> 10));
+	}
+	uint32_t A = State[0], B = State[1], C = State[2], D = State[3], E = State[4], F = State[5], G = State[6], H = State[7];
+	for (size_t Index = 0; Index < 64; ++Index)
+	{
+		auto const First = H + (Rotate(E, 6) ^ Rotate(E, 11) ^ Rotate(E, 25)) + ((E & F) ^ (~E & G)) + RoundConstants[Index] + Schedule[Index];
+		auto const Second = (Rotate(A, 2) ^ Rotate(A, 13) ^ Rotate(A, 22)) + ((A & B) ^ (A & C) ^ (B & C));
+		H = G;
+		G = F;
+		F = E;
+		E = D + First;
+		D = C;
+		C = B;
+		B = A;
+		A = First + Second;
+	}
+	State[0] += A; State[1] += B; State[2] += C; State[3] += D;
+	State[4] += E; State[5] += F; State[6] += G; State[7] += H;
+}
+
+Sha256T::Sha256T(void) :
+	State{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+{
+}
+
+void Sha256T::Update(void const *Data, size_t Size)
+{
+	auto Bytes = static_cast<uint8_t const *>(Data);
+	Total += Size;
+	if (PendingSize > 0)
+	{
+		auto const Take = std::min(Size, sizeof(Pending) - PendingSize);
+		memcpy(Pending + PendingSize, Bytes, Take);
+		PendingSize += Take;
+		Bytes += Take;
+		Size -= Take;
+		if (PendingSize < sizeof(Pending)) return;
+		Compress(State, Pending);
+		PendingSize = 0;
+	}
+	for (; Size >= sizeof(Pending); Bytes += sizeof(Pending), Size -= sizeof(Pending)) Compress(State, Bytes);
+	if (Size > 0) memcpy(Pending, Bytes, Size);
+	PendingSize = Size;
+}
+
+DigestT Sha256T::Finish(void)
+{
+	auto const Bits = Total * 8;
+	uint8_t Padding[72] = {0x80};
+	auto const PaddingSize = ((PendingSize < 56) ? 56 : 120) - PendingSize;
+	for (size_t Index = 0; Index < 8; ++Index) Padding[PaddingSize + Index] = static_cast<uint8_t>(Bits >> (56 - Index * 8));
+	Update(Padding, PaddingSize + 8);
+	DigestT Out;
+	for (size_t Index = 0; Index < 32; ++Index) Out[Index] = static_cast<uint8_t>(State[Index / 4] >> (24 - (Index % 4) * 8));
+	return Out;
+}
+
+std::string Sha256T::Hex(DigestT const &Digest)
+{
+	static char const Digits[] = "0123456789abcdef";
+	std::string Out;
+	Out.reserve(Digest.size() * 2);
+	for (auto const Byte : Digest)
+	{
+		Out.push_back(Digits[Byte >> 4]);
+		Out.push_back(Digits[Byte & 0xF]);
+	}
+	return Out;
+}
+
+// Files
+
+namespace
+{
+	struct BufferT
+	{
+		BufferT(size_t Size) : Storage(new uint8_t[Size + Alignment]), Size(Size)
+		{
+			// Left uninitialized; zeroing a large buffer costs more than hashing a small file
+			auto const Address = reinterpret_cast<uintptr_t>(Storage.get());
+			Data = Storage.get() + ((Alignment - Address % Alignment) % Alignment);
+		}
+
+		static size_t const Alignment = 4096;
+		std::unique_ptr<uint8_t[]> Storage;
+		uint8_t *Data;
+		size_t const Size;
+	};
+
+	FileHashT HashFile(PathT const &Path, HashSettingsT const &Settings, BufferT &Buffer)
+	{
+		FileHashT Out;
+		Out.Path = Path;
+		try
+		{
+			FastHasherT Fast;
+			OptionalT<Sha256T> Strong;
+			if (Settings.Strong) Strong = Sha256T();
+			auto const Limit = Settings.Prefix ? *Settings.Prefix : UINT64_MAX;
+			auto const Consume = [&](uint8_t const *Data, size_t Size)
+			{
+				Fast.Update(Data, Size);
+				if (Strong) Strong->Update(Data, Size);
+			};
+#ifndef _WIN32
+			auto File = RawFileT::OpenRead(Path, (Limit < Buffer.Size) ? AccessT::Normal : AccessT::Sequential);
+			Out.Size = File.Size();
+			// Read to the end rather than to the size, in case the file changes meanwhile
+			for (uint64_t Offset = 0; Offset < Limit;)
+			{
+				auto const Wanted = static_cast<size_t>(std::min<uint64_t>(Buffer.Size, Limit - Offset));
+				auto const Read = File.ReadAt(Offset, Buffer.Data, Wanted);
+				Consume(Buffer.Data, Read);
+				Offset += Read;
+				if (Read < Wanted) break;
+			}
+#else
+			auto const Stat = Path.Stat();
+			if (!Stat) throw SYSTEM_ERROR << "Unable to stat file [" << Path << "]";
+			Out.Size = Stat->Size;
+			auto File = FileT::OpenRead(Path, AccessT::Sequential);
+			std::vector<uint8_t> Chunk;
+			for (uint64_t Offset = 0; Offset < Limit;)
+			{
+				Chunk.resize(static_cast<size_t>(std::min<uint64_t>(Buffer.Size, Limit - Offset)));
+				auto const Wanted = Chunk.size();
+				File.Read(Chunk);
+				Consume(Chunk.data(), Chunk.size());
+				Offset += Chunk.size();
+				if (Chunk.size() < Wanted) break;
+			}
+#endif
+			Out.Fast = Fast.Finish();
+			if (Strong) Out.Strong = Strong->Finish();
+		}
+		catch (std::exception const &Caught) { Out.Error = std::string(Caught.what()); }
+		return Out;
+	}
+
+	// Buffers shared by the tasks of a pool.  A worker runs one task at a time, so with
+	// enough buffers for every thread there's always one free for a running task.
+	struct BuffersT
+	{
+		BuffersT(size_t Count, size_t Size)
+		{
+			for (size_t Index = 0; Index < Count; ++Index) Free.push_back(std::make_unique<BufferT>(Size));
+		}
+
+		std::unique_ptr<BufferT> Take(void)
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Assert(!Free.empty());
+			auto Out = std::move(Free.back());
+			Free.pop_back();
+			return Out;
+		}
+
+		void Give(std::unique_ptr<BufferT> &&Buffer)
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			Free.push_back(std::move(Buffer));
+		}
+
+		std::mutex Mutex;
+		std::vector<std::unique_ptr<BufferT>> Free;
+	};
+
+	size_t RoundBuffer(HashSettingsT const &Settings)
+		{ return std::max<size_t>(1, (Settings.BufferSize + BufferT::Alignment - 1) / BufferT::Alignment) * BufferT::Alignment; }
+
+	// Threads for Tasks tasks that each hold Buffers buffers of BufferSize
+	size_t PoolThreads(HashSettingsT const &Settings, size_t BufferSize, size_t Buffers, size_t Tasks)
+	{
+		size_t Threads = Settings.Threads ? Settings.Threads : std::thread::hardware_concurrency();
+		return std::max<size_t>(1, std::min({Threads, Settings.MemoryLimit / (BufferSize * Buffers), Tasks}));
+	}
+
+	// Throws if either file can't be read
+	bool SameContents(PathT const &First, PathT const &Second, BufferT &FirstBuffer, BufferT &SecondBuffer)
+	{
+#ifndef _WIN32
+		auto FirstFile = RawFileT::OpenRead(First, AccessT::Sequential);
+		auto SecondFile = RawFileT::OpenRead(Second, AccessT::Sequential);
+		for (uint64_t Offset = 0;;)
+		{
+			auto const FirstRead = FirstFile.ReadAt(Offset, FirstBuffer.Data, FirstBuffer.Size);
+			auto const SecondRead = SecondFile.ReadAt(Offset, SecondBuffer.Data, SecondBuffer.Size);
+			if ((FirstRead != SecondRead) || (memcmp(FirstBuffer.Data, SecondBuffer.Data, FirstRead) != 0)) return false;
+			if (FirstRead < FirstBuffer.Size) return true;
+			Offset += FirstRead;
+		}
+#else
+		auto FirstFile = FileT::OpenRead(First, AccessT::Sequential);
+		auto SecondFile = FileT::OpenRead(Second, AccessT::Sequential);
+		std::vector<uint8_t> FirstChunk, SecondChunk;
+		while (true)
+		{
+			FirstChunk.resize(FirstBuffer.Size);
+			SecondChunk.resize(SecondBuffer.Size);
+			FirstFile.Read(FirstChunk);
+			SecondFile.Read(SecondChunk);
+			if (FirstChunk != SecondChunk) return false;
+			if (FirstChunk.size() < FirstBuffer.Size) return true;
+		}
+#endif
+	}
+
+	std::string SortKey(PathT const &Path) { return Path.Render(); }
+
+	void SortGroups(std::vector<std::vector<PathT>> &Groups)
+	{
+		for (auto &Group : Groups)
+			std::sort(Group.begin(), Group.end(), [](PathT const &First, PathT const &Second) { return SortKey(First) < SortKey(Second); });
+		std::sort(Groups.begin(), Groups.end(), [](auto const &First, auto const &Second)
+			{ return SortKey(First.front()) < SortKey(Second.front()); });
+	}
+}
+
+// Calls back with each hash and its position in Paths
+static void HashEach(std::vector<PathT> const &Paths, HashSettingsT const &Settings, std::function<void(size_t Index, FileHashT &&Hash)> const &Callback)
+{
+	if (Paths.empty()) return;
+	auto const BufferSize = RoundBuffer(Settings);
+	auto const Threads = PoolThreads(Settings, BufferSize, 1, Paths.size());
+	BuffersT Buffers(Threads, BufferSize);
+	std::mutex CallbackMutex;
+
+	WorkPoolT Pool(Threads);
+	for (size_t Index = 0; Index < Paths.size(); ++Index)
+	{
+		Pool.Push([&, Index](void)
+		{
+			auto Buffer = Buffers.Take();
+			auto Hash = HashFile(Paths[Index], Settings, *Buffer);
+			Buffers.Give(std::move(Buffer));
+			std::lock_guard<std::mutex> Lock(CallbackMutex);
+			Callback(Index, std::move(Hash));
+		});
+	}
+	Pool.Wait();
+}
+
+void HashFiles(std::vector<PathT> const &Paths, HashSettingsT const &Settings, std::function<void(FileHashT &&Hash)> const &Callback)
+	{ HashEach(Paths, Settings, [&](size_t, FileHashT &&Hash) { Callback(std::move(Hash)); }); }
+
+std::vector<FileHashT> HashFiles(std::vector<PathT> const &Paths, HashSettingsT const &Settings)
+{
+	std::vector<FileHashT> Out(Paths.size());
+	HashEach(Paths, Settings, [&](size_t Index, FileHashT &&Hash) { Out[Index] = std::move(Hash); });
+	return Out;
+}
+
+// Splits each group into files with the same contents, dropping unique and unreadable files
+static std::vector<std::vector<PathT>> Compare(std::vector<std::vector<PathT>> const &Groups, HashSettingsT const &Settings)
+{
+	std::vector<std::vector<PathT>> Out;
+	if (Groups.empty()) return Out;
+	auto const BufferSize = RoundBuffer(Settings);
+	auto const Threads = PoolThreads(Settings, BufferSize, 2, Groups.size());
+	BuffersT Buffers(Threads * 2, BufferSize);
+	std::mutex Mutex;
+
+	WorkPoolT Pool(Threads);
+	for (auto const &Group : Groups)
+	{
+		Pool.Push([&](void)
+		{
+			auto First = Buffers.Take(), Second = Buffers.Take();
+			// Almost always one class; the first file of each stands for it
+			std::vector<std::vector<PathT>> Classes;
+			for (auto const &Path : Group)
+			{
+				try
+				{
+					auto Class = std::find_if(Classes.begin(), Classes.end(), [&](std::vector<PathT> const &Class)
+						{ return SameContents(Class.front(), Path, *First, *Second); });
+					if (Class != Classes.end()) Class->push_back(Path);
+					else Classes.push_back({Path});
+				}
+				catch (std::exception const &) {}
+			}
+			Buffers.Give(std::move(First));
+			Buffers.Give(std::move(Second));
+			std::lock_guard<std::mutex> Lock(Mutex);
+			for (auto &Class : Classes) if (Class.size() > 1) Out.push_back(std::move(Class));
+		});
+	}
+	Pool.Wait();
+	return Out;
+}
+
+std::vector<std::vector<PathT>> FindDuplicates(std::vector<PathT> const &Paths, HashSettingsT const &Settings, uint64_t PartialSize)
+{
+	std::vector<std::vector<PathT>> Out;
+
+	// Regular files by size
+	std::vector<std::pair<uint64_t, PathT>> Sized;
+	{
+		std::unordered_set<PathT> Seen;
+		for (auto const &Path : Paths)
+		{
+			if (!Seen.insert(Path).second) continue;
+			auto const Stat = Path.Stat();
+			if (!Stat || (Stat->Type != EntryTypeT::File)) continue;
+			Sized.emplace_back(Stat->Size, Path);
+		}
+	}
+	std::sort(Sized.begin(), Sized.end(), [](auto const &First, auto const &Second) { return First.first < Second.first; });
+
+	using GroupT = std::pair<uint64_t, std::vector<PathT>>; // Size and files
+	std::vector<GroupT> Tied;
+	for (size_t Start = 0, End = 0; Start < Sized.size(); Start = End)
+	{
+		for (End = Start + 1; (End < Sized.size()) && (Sized[End].first == Sized[Start].first); ++End) {}
+		if (End - Start < 2) continue;
+		std::vector<PathT> Group;
+		for (auto Index = Start; Index < End; ++Index) Group.push_back(Sized[Index].second);
+		// Empty files are all the same
+		if (Sized[Start].first == 0) Out.push_back(std::move(Group));
+		else Tied.emplace_back(Sized[Start].first, std::move(Group));
+	}
+
+	// Splits each group by hash, dropping files that are unique or unreadable
+	auto const Split = [&](std::vector<GroupT> const &Groups, HashSettingsT const &Pass)
+	{
+		std::vector<PathT> Flat;
+		std::vector<size_t> Owners;
+		for (size_t Group = 0; Group < Groups.size(); ++Group)
+			for (auto const &Path : Groups[Group].second)
+			{
+				Flat.push_back(Path);
+				Owners.push_back(Group);
+			}
+		auto const Hashes = HashFiles(Flat, Pass);
+		std::map<std::tuple<size_t, uint64_t, DigestT>, std::vector<PathT>> Split;
+		for (size_t Index = 0; Index < Hashes.size(); ++Index)
+		{
+			auto const &Hash = Hashes[Index];
+			if (Hash.Error) continue;
+			Split[std::make_tuple(Owners[Index], Hash.Fast, Hash.Strong ? *Hash.Strong : DigestT{})].push_back(Hash.Path);
+		}
+		std::vector<GroupT> Out;
+		for (auto &Group : Split)
+			if (Group.second.size() > 1) Out.emplace_back(Groups[std::get<0>(Group.first)].first, std::move(Group.second));
+		return Out;
+	};
+
+	auto Partial = Settings;
+	Partial.Strong = false;
+	Partial.Prefix = PartialSize;
+	auto Full = Settings;
+	Full.Prefix = {};
+
+	std::vector<GroupT> Unsettled;
+	std::vector<std::vector<PathT>> Hashed;
+	for (auto &Group : Split(Tied, Partial))
+	{
+		// The partial hash covered small files whole
+		if (!Settings.Strong && (Group.first <= PartialSize)) Hashed.push_back(std::move(Group.second));
+		else Unsettled.push_back(std::move(Group));
+	}
+	for (auto &Group : Split(Unsettled, Full)) Hashed.push_back(std::move(Group.second));
+
+	// A 64-bit hash can collide, so without SHA-256 the files are compared
+	if (Settings.Strong) std::move(Hashed.begin(), Hashed.end(), std::back_inserter(Out));
+	else for (auto &Group : Compare(Hashed, Settings)) Out.push_back(std::move(Group));
+
+	SortGroups(Out);
+	return Out;
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef ren_cxx_filesystem__hash_h
+#define ren_cxx_filesystem__hash_h
+
+#include "path.h"
+
+#include <array>
+#include <vector>
+#include <functional>
+
+namespace Filesystem
+{
+
+// A fast non-cryptographic 64-bit hash.  Eight 64-bit lanes take 64-byte stripes and are
+// scrambled every kilobyte, in the style of XXH3 but not compatible with it.  Results are
+// the same whichever kernel runs and however the input is split between updates.
+struct FastHasherT
+{
+	FastHasherT(uint64_t Seed = 0);
+
+	void Update(void const *Data, size_t Size);
+	uint64_t Finish(void) const; // Doesn't change the state; more can be added after
+
+	private:
+		static size_t const BlockSize = 1024;
+		uint64_t Lanes[8];
+		uint8_t Pending[BlockSize];
+		size_t PendingSize = 0;
+		uint64_t Total = 0;
+		uint64_t const Seed;
+};
+
+uint64_t FastHash(void const *Data, size_t Size, uint64_t Seed = 0);
+char const *HashKernel(void); // Name of the kernel the fast hash picked
+
+using DigestT = std::array<uint8_t, 32>;
+
+struct Sha256T
+{
+	Sha256T(void);
+
+	void Update(void const *Data, size_t Size);
+	DigestT Finish(void); // Once only
+
+	static std::string Hex(DigestT const &Digest);
+
+	private:
+		uint32_t State[8];
+		uint8_t Pending[64];
+		size_t PendingSize = 0;
+		uint64_t Total = 0;
+};
+
+struct HashSettingsT
+{
+	bool Strong = false; // Also compute SHA-256
+	OptionalT<uint64_t> Prefix; // Only hash this many leading bytes
+	size_t Threads = 0; // 0 for one per core
+	size_t BufferSize = 1 << 20; // Per read, rounded up to a page
+	size_t MemoryLimit = 64 << 20; // For all buffers together; limits the threads used
+};
+
+struct FileHashT
+{
+	PathT Path;
+	uint64_t Size = 0; // The whole file, even with a prefix
+	uint64_t Fast = 0;
+	OptionalT<DigestT> Strong;
+	OptionalT<std::string> Error; // Why the file couldn't be read, if it couldn't
+};
+
+// Hashes files on a pool of threads, each reading through its own aligned buffer.
+// Callback runs on the workers but one call at a time, in completion order.
+void HashFiles(std::vector<PathT> const &Paths, HashSettingsT const &Settings, std::function<void(FileHashT &&Hash)> const &Callback);
+std::vector<FileHashT> HashFiles(std::vector<PathT> const &Paths, HashSettingsT const &Settings = {}); // In input order
+
+// Groups files with identical contents.  Files are compared by size, then by a hash of
+// their first PartialSize bytes, and only files still tied are hashed in full.  Groups are
+// then confirmed by comparing contents, or with SHA-256 instead if Settings.Strong.
+// Missing, unreadable and non-regular files are skipped.
+// Groups and their members are sorted by path.
+std::vector<std::vector<PathT>> FindDuplicates(
+	std::vector<PathT> const &Paths,
+	HashSettingsT const &Settings = {},
+	uint64_t PartialSize = 4096);
+
+}
+
+#endif
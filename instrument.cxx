@@ -0,0 +1,184 @@
+#include "instrument.h"
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace Filesystem
+{
+namespace Instrument
+{
+
+#define FILESYSTEM_NAME(Name) #Name,
+static char const *const OperationNames[] = { FILESYSTEM_OPERATIONS(FILESYSTEM_NAME) };
+static char const *const CounterNames[] = { FILESYSTEM_COUNTERS(FILESYSTEM_NAME) };
+#undef FILESYSTEM_NAME
+
+char const *Name(OperationT Operation) { return OperationNames[static_cast<size_t>(Operation)]; }
+char const *Name(CounterT Counter) { return CounterNames[static_cast<size_t>(Counter)]; }
+
+LatencyT const &SnapshotT::operator [](OperationT Operation) const { return Operations[static_cast<size_t>(Operation)]; }
+uint64_t SnapshotT::operator [](CounterT Counter) const { return Counters[static_cast<size_t>(Counter)]; }
+
+namespace
+{
+	// Only the owning thread writes, so load-add-store is enough; atomics keep
+	// snapshots from other threads well defined
+	inline void Bump(std::atomic<uint64_t> &Value, uint64_t Amount)
+		{ Value.store(Value.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed); }
+
+	struct BlockT;
+
+	struct RegistryT
+	{
+		std::mutex Mutex;
+		std::vector<BlockT *> Live;
+		SnapshotT Retired; // From threads that have exited
+		SnapshotT Baseline; // Totals at the last Reset
+	};
+
+	// Leaked so threads exiting during static destruction can still retire
+	RegistryT &Registry(void)
+	{
+		static auto Out = new RegistryT;
+		return *Out;
+	}
+
+	struct BlockT
+	{
+		std::atomic<uint64_t> Calls[OperationCount] = {};
+		std::atomic<uint64_t> Nanoseconds[OperationCount] = {};
+		std::atomic<uint64_t> Buckets[OperationCount][BucketCount] = {};
+		std::atomic<uint64_t> Counters[CounterCount] = {};
+
+		BlockT(void)
+		{
+			auto &Registry = ::Filesystem::Instrument::Registry();
+			std::lock_guard<std::mutex> Lock(Registry.Mutex);
+			Registry.Live.push_back(this);
+		}
+
+		~BlockT(void)
+		{
+			auto &Registry = ::Filesystem::Instrument::Registry();
+			std::lock_guard<std::mutex> Lock(Registry.Mutex);
+			AddTo(Registry.Retired);
+			Registry.Live.erase(std::find(Registry.Live.begin(), Registry.Live.end(), this));
+		}
+
+		void AddTo(SnapshotT &Total) const
+		{
+			for (size_t Operation = 0; Operation < OperationCount; ++Operation)
+			{
+				auto &Latency = Total.Operations[Operation];
+				Latency.Calls += Calls[Operation].load(std::memory_order_relaxed);
+				Latency.Nanoseconds += Nanoseconds[Operation].load(std::memory_order_relaxed);
+				for (size_t Bucket = 0; Bucket < BucketCount; ++Bucket)
+					Latency.Buckets[Bucket] += Buckets[Operation][Bucket].load(std::memory_order_relaxed);
+			}
+			for (size_t Counter = 0; Counter < CounterCount; ++Counter)
+				Total.Counters[Counter] += Counters[Counter].load(std::memory_order_relaxed);
+		}
+	};
+
+	thread_local BlockT Block;
+
+	SnapshotT Totals(RegistryT const &Registry)
+	{
+		auto Out = Registry.Retired;
+		for (auto Block : Registry.Live) Block->AddTo(Out);
+		return Out;
+	}
+}
+
+bool Enabled(void)
+{
+#ifdef FILESYSTEM_INSTRUMENT
+	return true;
+#else
+	return false;
+#endif
+}
+
+SnapshotT Snapshot(void)
+{
+	auto &Registry = ::Filesystem::Instrument::Registry();
+	std::lock_guard<std::mutex> Lock(Registry.Mutex);
+	auto Out = Totals(Registry);
+	for (size_t Operation = 0; Operation < OperationCount; ++Operation)
+	{
+		auto &Latency = Out.Operations[Operation];
+		auto const &Base = Registry.Baseline.Operations[Operation];
+		Latency.Calls -= Base.Calls;
+		Latency.Nanoseconds -= Base.Nanoseconds;
+		for (size_t Bucket = 0; Bucket < BucketCount; ++Bucket) Latency.Buckets[Bucket] -= Base.Buckets[Bucket];
+	}
+	for (size_t Counter = 0; Counter < CounterCount; ++Counter) Out.Counters[Counter] -= Registry.Baseline.Counters[Counter];
+	return Out;
+}
+
+void Reset(void)
+{
+	// Other threads' blocks are never written here; later snapshots subtract this instead
+	auto &Registry = ::Filesystem::Instrument::Registry();
+	std::lock_guard<std::mutex> Lock(Registry.Mutex);
+	Registry.Baseline = Totals(Registry);
+}
+
+void Dump(std::ostream &Out, SnapshotT const &Snapshot)
+{
+	Out << "{\"enabled\": " << (Enabled() ? "true" : "false") << ", \"operations\": {";
+	bool First = true;
+	for (size_t Operation = 0; Operation < OperationCount; ++Operation)
+	{
+		auto const &Latency = Snapshot.Operations[Operation];
+		if (Latency.Calls == 0) continue;
+		Out << (First ? "" : ", ") << "\"" << OperationNames[Operation] << "\": {" <<
+			"\"calls\": " << Latency.Calls << ", " <<
+			"\"ns_total\": " << Latency.Nanoseconds << ", " <<
+			"\"ns_mean\": " << Latency.Nanoseconds / Latency.Calls << ", " <<
+			"\"histogram\": [";
+		bool FirstBucket = true;
+		for (size_t Bucket = 0; Bucket < BucketCount; ++Bucket)
+		{
+			if (Latency.Buckets[Bucket] == 0) continue;
+			// [upper bound in ns, calls]; the last bucket is unbounded
+			Out << (FirstBucket ? "" : ", ") << "[";
+			if (Bucket + 1 == BucketCount) Out << "null";
+			else Out << (uint64_t(1) << Bucket);
+			Out << ", " << Latency.Buckets[Bucket] << "]";
+			FirstBucket = false;
+		}
+		Out << "]}";
+		First = false;
+	}
+	Out << "}, \"counters\": {";
+	First = true;
+	for (size_t Counter = 0; Counter < CounterCount; ++Counter)
+	{
+		if (Snapshot.Counters[Counter] == 0) continue;
+		Out << (First ? "" : ", ") << "\"" << CounterNames[Counter] << "\": " << Snapshot.Counters[Counter];
+		First = false;
+	}
+	Out << "}}";
+}
+
+void Record(OperationT Operation, uint64_t Nanoseconds)
+{
+	auto const Index = static_cast<size_t>(Operation);
+#if defined(__GNUC__)
+	size_t Bucket = (Nanoseconds == 0) ? 0 : 64 - __builtin_clzll(Nanoseconds);
+#else
+	size_t Bucket = 0;
+	while ((Bucket < BucketCount) && (Nanoseconds >= (uint64_t(1) << Bucket))) ++Bucket;
+#endif
+	Bucket = std::min(Bucket, BucketCount - 1);
+	Bump(Block.Calls[Index], 1);
+	Bump(Block.Nanoseconds[Index], Nanoseconds);
+	Bump(Block.Buckets[Index][Bucket], 1);
+}
+
+void Count(CounterT Counter, uint64_t Amount) { Bump(Block.Counters[static_cast<size_t>(Counter)], Amount); }
+
+}
+}
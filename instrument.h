@@ -0,0 +1,109 @@
+#ifndef ren_cxx_filesystem__instrument_h
+#define ren_cxx_filesystem__instrument_h
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Operation counts and latencies, gathered when the library is built with
+// FILESYSTEM_INSTRUMENT defined.  Otherwise the hooks compile to nothing and snapshots
+// are all zero.
+//
+// Each thread records into its own block, so hooks cost a clock read and a few relaxed
+// stores.  Snapshots sum every thread's block, including threads that have exited.
+
+namespace Filesystem
+{
+namespace Instrument
+{
+
+#define FILESYSTEM_OPERATIONS(X) \
+	X(Stat) X(OpenDirectory) X(ReadDirectory) X(Unlink) X(RemoveDirectory) X(MakeDirectory) \
+	X(Rename) X(Copy) X(Link) X(Open) X(Close) X(Read) X(Write) X(Seek) X(Sync) X(Map) X(Hint)
+
+#define FILESYSTEM_COUNTERS(X) \
+	X(ElementsCreated) X(ElementsDestroyed) X(Renders) X(RenderedBytes) \
+	X(StatCacheHits) X(StatCacheMisses) X(BytesRead) X(BytesWritten)
+
+#define FILESYSTEM_ENUMERATE(Name) Name,
+enum struct OperationT : size_t { FILESYSTEM_OPERATIONS(FILESYSTEM_ENUMERATE) Count };
+enum struct CounterT : size_t { FILESYSTEM_COUNTERS(FILESYSTEM_ENUMERATE) Count };
+#undef FILESYSTEM_ENUMERATE
+
+size_t const OperationCount = static_cast<size_t>(OperationT::Count);
+size_t const CounterCount = static_cast<size_t>(CounterT::Count);
+size_t const BucketCount = 40; // Bucket N holds latencies in [2^(N-1), 2^N) ns
+
+char const *Name(OperationT Operation);
+char const *Name(CounterT Counter);
+
+struct LatencyT
+{
+	uint64_t Calls = 0;
+	uint64_t Nanoseconds = 0;
+	uint64_t Buckets[BucketCount] = {};
+};
+
+struct SnapshotT
+{
+	LatencyT Operations[OperationCount];
+	uint64_t Counters[CounterCount] = {};
+
+	LatencyT const &operator [](OperationT Operation) const;
+	uint64_t operator [](CounterT Counter) const;
+};
+
+bool Enabled(void); // Whether the library was built with FILESYSTEM_INSTRUMENT
+SnapshotT Snapshot(void); // Totals since the last Reset
+void Reset(void);
+void Dump(std::ostream &Out, SnapshotT const &Snapshot); // As JSON, omitting unused entries
+
+// Hooks, used through the macros below
+void Record(OperationT Operation, uint64_t Nanoseconds);
+void Count(CounterT Counter, uint64_t Amount);
+
+struct TimerT
+{
+	TimerT(OperationT Operation) : Operation(Operation), Start(std::chrono::steady_clock::now()) { }
+	~TimerT(void)
+	{
+		auto const Error = errno; // Callers check it after the timed call
+		Record(Operation, std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - Start).count());
+		errno = Error;
+	}
+
+	private:
+		OperationT const Operation;
+		std::chrono::steady_clock::time_point const Start;
+};
+
+template <typename CallT> inline auto Timed(OperationT Operation, CallT const &Call) -> decltype(Call())
+{
+	TimerT Timer(Operation);
+	return Call();
+}
+
+}
+}
+
+#ifdef FILESYSTEM_INSTRUMENT
+#define FILESYSTEM_JOIN2(A, B) A##B
+#define FILESYSTEM_JOIN(A, B) FILESYSTEM_JOIN2(A, B)
+// Times the rest of the enclosing scope
+#define FILESYSTEM_TIME(Operation) \
+	::Filesystem::Instrument::TimerT FILESYSTEM_JOIN(FilesystemTimer, __LINE__)(::Filesystem::Instrument::OperationT::Operation)
+// Times one expression, evaluating to its result
+#define FILESYSTEM_TIMED(Operation, Expression) \
+	::Filesystem::Instrument::Timed(::Filesystem::Instrument::OperationT::Operation, [&](void) { return (Expression); })
+#define FILESYSTEM_COUNT(Counter, Amount) \
+	::Filesystem::Instrument::Count(::Filesystem::Instrument::CounterT::Counter, (Amount))
+#else
+#define FILESYSTEM_TIME(Operation) do {} while (false)
+#define FILESYSTEM_TIMED(Operation, Expression) (Expression)
+#define FILESYSTEM_COUNT(Counter, Amount) do {} while (false)
+#endif
+
+#endif
@@ -1,6 +1,8 @@
 #include "path.h"
 
-#include <regex>
+#include <cstring>
+#include <mutex>
+#include <tuple>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -20,56 +22,229 @@ struct SeedRandomT
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 #endif
 
 #include "../ren-cxx-basics/error.h"
+#include "pool.h"
+#include "instrument.h"
 
 namespace Filesystem
 {
-PathElementT::PathElementT(PathSettingsT const &Settings) : Parent(new PathSettingsT(Settings)) { }
+
+static PathSettingsT *InternSettings(PathSettingsT const &Settings)
+{
+	// Roots with equal settings share one copy, kept until exit
+	auto const Matches = [&](PathSettingsT const *Candidate)
+		{ return (Candidate->WindowsDrive == Settings.WindowsDrive) && (Candidate->Separator == Settings.Separator); };
+	thread_local std::vector<PathSettingsT *> Known;
+	for (auto Candidate : Known) if (Matches(Candidate)) return Candidate;
+
+	static std::mutex Mutex;
+	static auto &Interned = *new std::list<PathSettingsT>;
+	std::lock_guard<std::mutex> Lock(Mutex);
+	PathSettingsT *Found = nullptr;
+	for (auto &Candidate : Interned) if (Matches(&Candidate)) { Found = &Candidate; break; }
+	if (!Found)
+	{
+		Interned.push_back(Settings);
+		Found = &Interned.back();
+	}
+	Known.push_back(Found);
+	return Found;
+}
+
+namespace
+{
+	// Elements are carved from slabs and recycled through per-thread free lists.  Surplus
+	// blocks move to a shared list in fixed-size batches so threads that only free (or
+	// only allocate) don't grow without bound.  Slabs are never returned to the system.
+	union ElementBlockT
+	{
+		ElementBlockT *Next;
+		alignas(PathElementT) unsigned char Storage[sizeof(PathElementT)];
+	};
+
+	constexpr size_t ElementBatchSize = 256;
+
+	struct ElementBatchesT
+	{
+		std::mutex Mutex;
+		std::vector<std::pair<ElementBlockT *, size_t>> Batches;
+
+		static ElementBatchesT &Get(void)
+		{
+			static auto &Batches = *new ElementBatchesT;
+			return Batches;
+		}
+	};
+
+	thread_local bool ElementPoolGone = false;
+
+	struct ElementPoolT
+	{
+		ElementBlockT *Free = nullptr;
+		size_t Count = 0;
+
+		~ElementPoolT(void)
+		{
+			ElementPoolGone = true;
+			if (Free) Release(Free, Count);
+		}
+
+		static void Release(ElementBlockT *Blocks, size_t Count)
+		{
+			auto &Shared = ElementBatchesT::Get();
+			std::lock_guard<std::mutex> Lock(Shared.Mutex);
+			Shared.Batches.emplace_back(Blocks, Count);
+		}
+
+		void *Allocate(void)
+		{
+			if (!Free)
+			{
+				auto &Shared = ElementBatchesT::Get();
+				{
+					std::lock_guard<std::mutex> Lock(Shared.Mutex);
+					if (!Shared.Batches.empty())
+					{
+						std::tie(Free, Count) = Shared.Batches.back();
+						Shared.Batches.pop_back();
+					}
+				}
+				if (!Free)
+				{
+					auto Slab = static_cast<ElementBlockT *>(::operator new(sizeof(ElementBlockT) * ElementBatchSize));
+					for (size_t Index = 0; Index + 1 < ElementBatchSize; ++Index) Slab[Index].Next = &Slab[Index + 1];
+					Slab[ElementBatchSize - 1].Next = nullptr;
+					Free = Slab;
+					Count = ElementBatchSize;
+				}
+			}
+			auto Out = Free;
+			Free = Free->Next;
+			Count -= 1;
+			return Out;
+		}
+
+		void Deallocate(void *Pointer)
+		{
+			auto Block = static_cast<ElementBlockT *>(Pointer);
+			Block->Next = Free;
+			Free = Block;
+			Count += 1;
+			if (Count >= ElementBatchSize * 2)
+			{
+				auto Last = Free;
+				for (size_t Index = 1; Index < ElementBatchSize; ++Index) Last = Last->Next;
+				auto Batch = Free;
+				Free = Last->Next;
+				Last->Next = nullptr;
+				Count -= ElementBatchSize;
+				Release(Batch, ElementBatchSize);
+			}
+		}
+	};
+
+	thread_local ElementPoolT ElementPool;
+}
+
+void *PathElementT::operator new(size_t Size)
+{
+	AssertLTE(Size, sizeof(ElementBlockT));
+	if (ElementPoolGone) return ::operator new(sizeof(ElementBlockT));
+	return ElementPool.Allocate();
+}
+
+void PathElementT::operator delete(void *Pointer)
+{
+	if (!Pointer) return;
+	auto Block = static_cast<ElementBlockT *>(Pointer);
+	if (ElementPoolGone)
+	{
+		Block->Next = nullptr;
+		ElementPoolT::Release(Block, 1);
+		return;
+	}
+	ElementPool.Deallocate(Block);
+}
+
+PathElementT::PathElementT(PathSettingsT const &Settings) : 
+	Parent(InternSettings(Settings)), 
+	Settings(Parent.Get<PathSettingsT *>()),
+	Size((Settings.WindowsDrive ? Settings.WindowsDrive->size() : 0) + Settings.Separator.size()),
+	Level(0),
+	Fingerprint(std::hash<std::string>()(Settings.WindowsDrive ? *Settings.WindowsDrive : std::string()))
+	{ FILESYSTEM_COUNT(ElementsCreated, 1); }
 
 PathElementT::~PathElementT(void)
 {
+	FILESYSTEM_COUNT(ElementsDestroyed, 1);
 	if (Parent.Is<PathElementT const *>())
 	{
 		auto Element = Parent.Get<PathElementT const *>();
-		Element->Count -= 1;
-		if (Element->Count == 0) delete Element;
-	}
-	else
-	{
-		Assert(Parent.Is<PathSettingsT *>());
-		delete Parent.Get<PathSettingsT *>();
+		if (Element->Count.fetch_sub(1, std::memory_order_acq_rel) == 1) delete Element;
 	}
+	else Assert(Parent.Is<PathSettingsT *>());
 }
 
 std::string PathElementT::Render(void) const
 {
-	PathSettingsT *Root = nullptr;
-	std::list<PathElementT const *> Parts;
+	std::string Out(Size, 0);
+	Render(&Out[0]);
+	return Out;
+}
+
+size_t PathElementT::RenderSize(void) const { return Size; }
+
+void PathElementT::Render(char *Buffer) const
+{
+	FILESYSTEM_COUNT(Renders, 1);
+	FILESYSTEM_COUNT(RenderedBytes, Size);
+	auto const &Separator = Settings->Separator;
+	auto Cursor = Buffer + Size;
+	PathElementT const *Part = this;
+	while (Part->Parent.Is<PathElementT const *>())
 	{
-		VariantT <PathElementT const *, PathSettingsT *> Part(this);
-		while (Part.Is<PathElementT const *>())
-		{
-			Parts.push_front(Part.Get<PathElementT const *>());
-			Part = Part.Get<PathElementT const *>()->Parent;
-		}
-		Root = Part.Get<PathSettingsT *>();
+		Cursor -= Part->Value.size();
+		memcpy(Cursor, Part->Value.data(), Part->Value.size());
+		Cursor -= Separator.size();
+		memcpy(Cursor, Separator.data(), Separator.size());
+		Part = Part->Parent.Get<PathElementT const *>();
 	}
-	std::stringstream Out;
-	if (Root->WindowsDrive) Out << *Root->WindowsDrive;
-	if (Parts.size() == 1)
+	if (Part == this)
 	{
-		Out << Root->Separator;
+		Cursor -= Separator.size();
+		memcpy(Cursor, Separator.data(), Separator.size());
 	}
-	else
+	if (Settings->WindowsDrive) memcpy(Buffer, Settings->WindowsDrive->data(), Settings->WindowsDrive->size());
+}
+
+#ifndef _WIN32
+template <typename CallbackT> static auto WithRendered(PathElementT const *Element, CallbackT const &Callback) -> decltype(Callback(""))
+{
+	// Renders into a stack buffer for the common case to avoid allocating for each system call
+	char Buffer[512];
+	auto const Size = Element->RenderSize();
+	if (Size < sizeof(Buffer))
 	{
-		if (!Parts.empty()) Parts.pop_front();
-		for (auto &Part : Parts) Out << Root->Separator << Part->Value;
+		Element->Render(Buffer);
+		Buffer[Size] = 0;
+		return Callback(Buffer);
 	}
-	return Out.str();
+	auto const Rendered = Element->Render();
+	return Callback(Rendered.c_str());
 }
+#endif
 
 std::string const &PathElementT::Filename(void) const { return Value; }
 
@@ -78,72 +253,63 @@ std::string PathElementT::Directory(void) const
 
 OptionalT<std::string> PathElementT::Extension(void) const
 {
-	std::smatch Matches;
-	std::regex_search(Value, Matches, std::regex("\\.([^.]+)$"));
-	for (auto &Match : Matches) return Match.str();
-	return {};
+	auto const Dot = Value.rfind('.');
+	if ((Dot == std::string::npos) || (Dot + 1 == Value.size())) return {};
+	return Value.substr(Dot);
 }
 
-size_t PathElementT::Depth(void) const
-{
-	size_t Count = 0;
-	VariantT <PathElementT const *, PathSettingsT *> Part(this);
-	while (Part.Is<PathElementT const *>())
-	{
-		++Count;
-		Part = Part.Get<PathElementT const *>()->Parent;
-	}
-	return Count - 1;
-}
+size_t PathElementT::Depth(void) const { return Level; }
+
+size_t PathElementT::Hash(void) const { return Fingerprint; }
 
 bool PathElementT::Contains(PathElementT const *Other) const
 {
-	PathElementT const *Candidates[2]{this, Other};
-	PathSettingsT *PathSettings[2];
-	std::vector<PathElementT const *> Parts[2];
-	for (size_t Candidate = 0; Candidate < 2; ++Candidate)
+	if (Other->Level < Level) return false;
+	for (auto Skip = Other->Level - Level; Skip > 0; --Skip) 
+		Other = Other->Parent.Get<PathElementT const *>();
+	PathElementT const *Part = this;
+	while (Part != Other)
 	{
-		VariantT <PathElementT const *, PathSettingsT *> Part(Candidates[Candidate]);
-		while (Part.Is<PathElementT const *>())
-		{
-			Parts[Candidate].push_back(Part.Get<PathElementT const *>());
-			Part = Part.Get<PathElementT const *>()->Parent;
-		}
-		std::reverse(Parts[Candidate].begin(), Parts[Candidate].end());
-		PathSettings[Candidate] = Part.Get<PathSettingsT *>();
+		if (Part->Fingerprint != Other->Fingerprint) return false;
+		if (Part->Parent.Is<PathSettingsT *>()) 
+			return Part->Settings->WindowsDrive == Other->Settings->WindowsDrive;
+		if (Part->Value != Other->Value) return false;
+		Part = Part->Parent.Get<PathElementT const *>();
+		Other = Other->Parent.Get<PathElementT const *>();
 	}
-	if (PathSettings[0]->WindowsDrive != PathSettings[1]->WindowsDrive) return false;
-	if (Parts[1].size() < Parts[0].size()) return false;
-	for (size_t Part = 0; Part < Parts[0].size(); ++Part)
-		if (Parts[0][Part]->Value != Parts[1][Part]->Value) return false;
 	return true;
 }
 
+bool PathElementT::operator ==(PathElementT const &Other) const
+{
+	if (&Other == this) return true;
+	if ((Level != Other.Level) || (Fingerprint != Other.Fingerprint)) return false;
+	return Contains(&Other);
+}
+
+bool PathElementT::operator !=(PathElementT const &Other) const { return !(*this == Other); }
+
 PathT PathElementT::Enter(std::string const &Value) const
 {
 	for (size_t pos = 0; pos < Value.size(); pos++) AssertNE(Value[pos], 0);
 	return PathT(new PathElementT(this, Value));
 }
 
-std::regex ElementRegex("([^/\\\\]*)[/\\\\]+");
 PathT PathElementT::EnterRaw(std::string const &Raw) const
 {
-	std::string Text = Raw;
 	PathT Out(this);
-	auto HandleMatch = [&](auto const &Match)
+	size_t Start = 0;
+	while (Start <= Raw.size())
 	{
-		if (Match.length() == 0) {}
-		else if (Match == ".") {}
-		else if (Match == "..") Out = Out.Exit();
-		else Out = Out.Enter(Match);
-	};
-	std::smatch Matches;
-	while (std::regex_search(Text, Matches, ElementRegex))
-	{
-		HandleMatch(Matches[1]);
-		Text = Matches.suffix().str();
+		auto Stop = Start;
+		while ((Stop < Raw.size()) && (Raw[Stop] != '/') && (Raw[Stop] != '\\')) ++Stop;
+		auto const Length = Stop - Start;
+		if (Length == 0) {}
+		else if ((Length == 1) && (Raw[Start] == '.')) {}
+		else if ((Length == 2) && (Raw[Start] == '.') && (Raw[Start + 1] == '.')) Out = Out.Exit();
+		else Out = Out.Enter(Raw.substr(Start, Length));
+		Start = Stop + 1;
 	}
-	HandleMatch(Text);
 	return Out;
 }
 
@@ -153,49 +319,326 @@ PathT PathElementT::Exit(void) const
 	return {Parent.Get<PathElementT const *>()};
 }
 
-bool PathElementT::Exists(void) const
+#ifndef _WIN32
+EntryTypeT TypeFromMode(uint32_t Mode)
 {
-#ifdef _WIN32
-	return GetFileAttributesW(&ToNativeString("\\\\?\\" + Render())[0]) != INVALID_FILE_ATTRIBUTES;
+	if (S_ISREG(Mode)) return EntryTypeT::File;
+	if (S_ISDIR(Mode)) return EntryTypeT::Directory;
+	if (S_ISLNK(Mode)) return EntryTypeT::Link;
+	if (S_ISFIFO(Mode)) return EntryTypeT::Pipe;
+	if (S_ISSOCK(Mode)) return EntryTypeT::Socket;
+	if (S_ISCHR(Mode)) return EntryTypeT::Character;
+	if (S_ISBLK(Mode)) return EntryTypeT::Block;
+	return EntryTypeT::Unknown;
+}
+
+static bool StatAt(int Directory, char const *Name, int Flags, StatT &Out)
+{
+	FILESYSTEM_TIME(Stat);
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+	struct statx Result;
+	if (statx(Directory, Name, Flags, STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &Result) != 0) 
+		return false;
+	Out.Type = TypeFromMode(Result.stx_mode);
+	Out.Size = Result.stx_size;
+	Out.Modified = static_cast<int64_t>(Result.stx_mtime.tv_sec) * 1000000000 + Result.stx_mtime.tv_nsec;
+	Out.Changed = static_cast<int64_t>(Result.stx_ctime.tv_sec) * 1000000000 + Result.stx_ctime.tv_nsec;
+	Out.Mode = Result.stx_mode;
+	Out.Inode = Result.stx_ino;
+	Out.Device = makedev(Result.stx_dev_major, Result.stx_dev_minor);
 #else
-	struct stat StatResultBuffer;
-	return stat(Render().c_str(), &StatResultBuffer) == 0;
+	struct stat Result;
+	if (fstatat(Directory, Name, &Result, Flags) != 0) return false;
+	Out.Type = TypeFromMode(Result.st_mode);
+	Out.Size = Result.st_size;
+	Out.Modified = static_cast<int64_t>(Result.st_mtim.tv_sec) * 1000000000 + Result.st_mtim.tv_nsec;
+	Out.Changed = static_cast<int64_t>(Result.st_ctim.tv_sec) * 1000000000 + Result.st_ctim.tv_nsec;
+	Out.Mode = Result.st_mode;
+	Out.Inode = Result.st_ino;
+	Out.Device = Result.st_dev;
 #endif
+	return true;
 }
+#endif
 
-bool PathElementT::FileExists(void) const
+namespace
+{
+	thread_local StatCacheT *ActiveStatCache = nullptr;
+}
+
+StatCacheT::ScopeT::ScopeT(StatCacheT *Cache) : Previous(ActiveStatCache) { ActiveStatCache = Cache; }
+
+StatCacheT::ScopeT::~ScopeT(void) { ActiveStatCache = Previous; }
+
+StatCacheT *StatCacheT::Active(void) { return ActiveStatCache; }
+
+void StatCacheT::Invalidate(PathT const &Path)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	++Generation;
+	Entries.erase(Path);
+	Types.erase(Path);
+}
+
+void StatCacheT::InvalidateBelow(PathT const &Path)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	++Generation;
+	for (auto Entry = Entries.begin(); Entry != Entries.end();)
+	{
+		if (Path.Contains(Entry->first)) Entry = Entries.erase(Entry);
+		else ++Entry;
+	}
+	for (auto Entry = Types.begin(); Entry != Types.end();)
+	{
+		if (Path.Contains(Entry->first)) Entry = Types.erase(Entry);
+		else ++Entry;
+	}
+}
+
+void StatCacheT::Clear(void)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	++Generation;
+	Entries.clear();
+	Types.clear();
+}
+
+size_t StatCacheT::Size(void) const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return Entries.size() + Types.size();
+}
+
+static void InvalidateStat(PathElementT const *Element, bool Below)
+{
+	auto Cache = StatCacheT::Active();
+	if (!Cache) return;
+	if (Below) Cache->InvalidateBelow(PathT(Element));
+	else Cache->Invalidate(PathT(Element));
+}
+
+namespace
+{
+	// Invalidates once the operation is done, so a walker sharing the cache can't recache
+	// the old state between the invalidation and the change
+	struct InvalidateStatT
+	{
+		enum struct ExtentT { Path, Below, Ancestors };
+
+		PathElementT const *Element;
+		ExtentT Extent;
+
+		~InvalidateStatT(void)
+		{
+			if (Extent != ExtentT::Ancestors) InvalidateStat(Element, Extent == ExtentT::Below);
+			else for (PathT Part(Element); Part.Depth() > 0; Part = Part.Exit()) InvalidateStat(Part, false);
+		}
+	};
+}
+
+OptionalT<StatT> PathElementT::Stat(void) const
 {
+	auto Cache = StatCacheT::Active();
+	uint64_t Generation = 0;
+	if (Cache)
+	{
+		std::lock_guard<std::mutex> Lock(Cache->Mutex);
+		auto Found = Cache->Entries.find(PathT(this));
+		if (Found != Cache->Entries.end()) 
+		{
+			FILESYSTEM_COUNT(StatCacheHits, 1);
+			return Found->second;
+		}
+		FILESYSTEM_COUNT(StatCacheMisses, 1);
+		Generation = Cache->Generation;
+	}
+	OptionalT<StatT> Out;
 #ifdef _WIN32
-	auto Attributes = GetFileAttributesW(&ToNativeString("\\\\?\\" + Render())[0]); // Doesn't work for some reason -- mixed slashes?
-	if (Attributes == 0xFFFFFFFF) return false;
-	if (Attributes == 0x10) return false;
-	return true;
+	WIN32_FILE_ATTRIBUTE_DATA Attributes;
+	if (GetFileAttributesExW(&ToNativeString("\\\\?\\" + Render())[0], GetFileExInfoStandard, &Attributes))
+	{
+		StatT Result{};
+		Result.Type = 
+			(Attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? EntryTypeT::Directory : 
+			EntryTypeT::File;
+		Result.Size = (static_cast<uint64_t>(Attributes.nFileSizeHigh) << 32) | Attributes.nFileSizeLow;
+		auto const Ticks = (static_cast<int64_t>(Attributes.ftLastWriteTime.dwHighDateTime) << 32) | Attributes.ftLastWriteTime.dwLowDateTime;
+		Result.Modified = (Ticks - 116444736000000000ll) * 100; // 100ns ticks since 1601
+		Result.Changed = Result.Modified;
+		Result.Mode = Attributes.dwFileAttributes;
+		Out = Result;
+	}
 #else
-	struct stat StatResultBuffer;
-	int Result = stat(Render().c_str(), &StatResultBuffer);
-	if (Result != 0) return false;
-	return S_ISREG(StatResultBuffer.st_mode);
+	StatT Result;
+	if (WithRendered(this, [&](char const *Rendered) { return StatAt(AT_FDCWD, Rendered, 0, Result); }))
+		Out = Result;
 #endif
+	if (Cache)
+	{
+		// Not if something was invalidated meanwhile, which might have been this
+		std::lock_guard<std::mutex> Lock(Cache->Mutex);
+		if (Cache->Generation == Generation) Cache->Entries.emplace(PathT(this), Out);
+	}
+	return Out;
 }
 
-bool PathElementT::DirectoryExists(void) const
+bool PathElementT::Exists(void) const
 {
 #ifdef _WIN32
-        return GetFileAttributesW(&ToNativeString("\\\\?\\" + Render())[0]) & 0x10;
+	if (!StatCacheT::Active()) return GetFileAttributesW(&ToNativeString("\\\\?\\" + Render())[0]) != INVALID_FILE_ATTRIBUTES;
+#endif
+	return bool(Stat());
+}
+
+bool PathElementT::FileExists(void) const
+{
+	auto Result = Stat();
+	return Result && (Result->Type == EntryTypeT::File);
+}
+
+bool PathElementT::DirectoryExists(void) const
+{
+	auto Result = Stat();
+	return Result && (Result->Type == EntryTypeT::Directory);
+}
+
+#ifndef _WIN32
+// Resolves the type of an entry the listing didn't give one, without following links
+using UntypedT = std::function<EntryTypeT(int Directory, char const *Name)>;
+
+static EntryTypeT UnfollowedType(int Directory, char const *Name)
+{
+	FILESYSTEM_TIME(Stat);
+	struct stat StatResultBuffer;
+	if (fstatat(Directory, Name, &StatResultBuffer, AT_SYMLINK_NOFOLLOW) != 0) return EntryTypeT::Unknown;
+	return TypeFromMode(StatResultBuffer.st_mode);
+}
+
+static EntryTypeT TypeFromDirent(int Directory, char const *Name, unsigned char Type, UntypedT const *Untyped)
+{
+	switch (Type)
+	{
+		case DT_REG: return EntryTypeT::File;
+		case DT_DIR: return EntryTypeT::Directory;
+		case DT_LNK: return EntryTypeT::Link;
+		case DT_FIFO: return EntryTypeT::Pipe;
+		case DT_SOCK: return EntryTypeT::Socket;
+		case DT_CHR: return EntryTypeT::Character;
+		case DT_BLK: return EntryTypeT::Block;
+		default: break;
+	}
+	// Some filesystems don't report types while listing
+	return Untyped ? (*Untyped)(Directory, Name) : UnfollowedType(Directory, Name);
+}
+#endif
+
+#ifdef __linux__
+namespace
+{
+	struct LinuxDirentT
+	{
+		uint64_t Inode;
+		int64_t Offset;
+		unsigned short Length;
+		unsigned char Type;
+		char Name[];
+	};
+
+	// Listing buffers are reused by later (and nested) listings on the same thread
+	constexpr size_t ListBufferSize = 64 * 1024;
+	struct ListBufferT
+	{
+		ListBufferT(void)
+		{
+			if (Spare.empty()) Data = std::make_unique<char[]>(ListBufferSize);
+			else
+			{
+				Data = std::move(Spare.back());
+				Spare.pop_back();
+			}
+		}
+
+		~ListBufferT(void) { Spare.push_back(std::move(Data)); }
+
+		std::unique_ptr<char[]> Data;
+		static thread_local std::vector<std::unique_ptr<char[]>> Spare;
+	};
+	thread_local std::vector<std::unique_ptr<char[]>> ListBufferT::Spare;
+}
+#endif
+
+#ifndef _WIN32
+static bool ScanDescriptor(int Descriptor, std::function<bool(DirectoryEntryT const &Entry)> const &Process, UntypedT const *Untyped = nullptr)
+{
+#ifdef __linux__
+	if (lseek(Descriptor, 0, SEEK_SET) != 0) return false;
+	ListBufferT Buffer;
+	while (true)
+	{
+		auto const Read = FILESYSTEM_TIMED(ReadDirectory, syscall(SYS_getdents64, Descriptor, Buffer.Data.get(), ListBufferSize));
+		if (Read < 0) return false;
+		if (Read == 0) break;
+		for (long Offset = 0; Offset < Read;)
+		{
+			auto const Entry = reinterpret_cast<LinuxDirentT const *>(Buffer.Data.get() + Offset);
+			Offset += Entry->Length;
+			if ((Entry->Name[0] == '.') && ((Entry->Name[1] == 0) || ((Entry->Name[1] == '.') && (Entry->Name[2] == 0))))
+				continue;
+			if (!Process(DirectoryEntryT{
+				Entry->Name, 
+				TypeFromDirent(Descriptor, Entry->Name, Entry->Type, Untyped), 
+				Entry->Inode}))
+				return true;
+		}
+	}
 #else
-        struct stat StatResultBuffer;
-        int Result = stat(Render().c_str(), &StatResultBuffer);
-        if (Result != 0) return false;
-        return S_ISDIR(StatResultBuffer.st_mode);
+	auto const Duplicate = dup(Descriptor);
+	if (Duplicate < 0) return false;
+        auto DirectoryResource = fdopendir(Duplicate);
+        if (DirectoryResource == nullptr) 
+	{
+		close(Duplicate);
+		return false;
+	}
+	rewinddir(DirectoryResource);
+
+        dirent *ElementInfo;
+        while ((ElementInfo = FILESYSTEM_TIMED(ReadDirectory, readdir(DirectoryResource))) != nullptr)
+        {
+		std::string_view ElementName(ElementInfo->d_name);
+                if ((ElementName == ".") || (ElementName == "..")) continue;
+		if (!Process(DirectoryEntryT{
+			ElementName, 
+			TypeFromDirent(Descriptor, ElementInfo->d_name, ElementInfo->d_type, Untyped), 
+			ElementInfo->d_ino}))
+			break;
+        }
+
+        closedir(DirectoryResource);
 #endif
+	return true;
+}
+
+static int OpenDirectory(PathElementT const *Directory)
+{
+	FILESYSTEM_TIME(OpenDirectory);
+	return WithRendered(Directory, [](char const *Rendered) 
+		{ return open(Rendered, O_RDONLY | O_DIRECTORY | O_CLOEXEC); });
 }
+#endif
 
-static bool ProcessDirectoryContents(PathT const &DirectoryName, std::function<void(std::string const &Element, bool IsFile, bool IsDir)> const &Process)
+#ifdef _WIN32
+static bool ScanDirectory(PathElementT const *Directory, std::function<bool(DirectoryEntryT const &Entry)> const &Process)
+#else
+static bool ScanDirectory(PathElementT const *Directory, std::function<bool(DirectoryEntryT const &Entry)> const &Process, UntypedT const *Untyped)
+#endif
 {
 #ifdef _WIN32
+	FILESYSTEM_TIME(ReadDirectory);
         WIN32_FIND_DATAW ElementInfo;
         auto DirectoryResource = FindFirstFileW(
-		&ToNativeString(DirectoryName.Render() + "\\*")[0],
+		&ToNativeString(Directory->Render() + "\\*")[0],
 		&ElementInfo);
         if (DirectoryResource == INVALID_HANDLE_VALUE) return false;
 
@@ -204,86 +647,451 @@ static bool ProcessDirectoryContents(PathT const &DirectoryName, std::function<v
                 auto FindName = FromNativeString(ElementInfo.cFileName, wcslen(ElementInfo.cFileName));
 		if (FindName == ".") continue;
 		if (FindName == "..") continue;
-                Process(
-			FindName,
-			ElementInfo.dwFileAttributes & ~FILE_ATTRIBUTE_DIRECTORY,
-			!(ElementInfo.dwFileAttributes & ~FILE_ATTRIBUTE_DIRECTORY));
+		auto const Type = 
+			(ElementInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? EntryTypeT::Link :
+			(ElementInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? EntryTypeT::Directory :
+			EntryTypeT::File;
+		if (!Process(DirectoryEntryT{FindName, Type, 0})) break;
         } while (FindNextFileW(DirectoryResource, &ElementInfo) != 0);
 
         FindClose(DirectoryResource);
+	return true;
 #else
-        auto DirectoryResource = opendir(DirectoryName.Render().c_str());
-        if (DirectoryResource == nullptr) return false;
-
-        dirent *ElementInfo;
-        while ((ElementInfo = readdir(DirectoryResource)) != nullptr)
-        {
-		std::string ElementName(ElementInfo->d_name);
-                if ((ElementName == ".") || (ElementName == "..")) continue;
-                Process(
-			ElementName,
-			ElementInfo->d_type != DT_DIR, 
-			ElementInfo->d_type == DT_DIR);
-        }
+	auto const Descriptor = OpenDirectory(Directory);
+	if (Descriptor < 0) return false;
+	auto const Result = ScanDescriptor(Descriptor, Process, Untyped);
+	close(Descriptor);
+	return Result;
+#endif
+}
 
-        closedir(DirectoryResource);
+bool PathElementT::Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const
+{
+#ifdef _WIN32
+	return ScanDirectory(this, Callback);
+#else
+	// Entries the listing didn't type are looked up in the cache, keyed by path
+	auto const Cache = StatCacheT::Active();
+	if (!Cache) return ScanDirectory(this, Callback, nullptr);
+	UntypedT const Untyped = [&](int Directory, char const *Name)
+	{
+		auto const Path = Enter(Name);
+		uint64_t Generation;
+		{
+			std::lock_guard<std::mutex> Lock(Cache->Mutex);
+			auto Found = Cache->Types.find(Path);
+			if (Found != Cache->Types.end())
+			{
+				FILESYSTEM_COUNT(StatCacheHits, 1);
+				return Found->second;
+			}
+			FILESYSTEM_COUNT(StatCacheMisses, 1);
+			Generation = Cache->Generation;
+		}
+		auto const Type = UnfollowedType(Directory, Name);
+		std::lock_guard<std::mutex> Lock(Cache->Mutex);
+		if (Cache->Generation == Generation) Cache->Types.emplace(Path, Type);
+		return Type;
+	};
+	return ScanDirectory(this, Callback, &Untyped);
 #endif
-	return true;
 }
 
 bool PathElementT::List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const
 {
-        return ProcessDirectoryContents(PathT(this), [&](std::string const &Element, bool IsFile, bool IsDir)
+	return Scan([&](DirectoryEntryT const &Entry)
+	{
+		return Callback(Enter(std::string(Entry.Name)), Entry.Type == EntryTypeT::File, Entry.Type == EntryTypeT::Directory);
+	});
+}
+
+namespace
+{
+	struct WalkDirectoryT
+	{
+		PathT Path;
+		size_t Depth;
+		std::shared_ptr<WalkDirectoryT> Parent;
+		std::atomic<size_t> Pending{1};
+
+		WalkDirectoryT(PathT const &Path, size_t Depth, std::shared_ptr<WalkDirectoryT> const &Parent) : 
+			Path(Path), Depth(Depth), Parent(Parent) { }
+	};
+}
+
+static bool WalkOrdered(PathT const &Directory, size_t Depth, WalkT const &Settings)
+{
+	std::vector<std::tuple<PathT, bool, bool>> Entries;
+	bool Listed = Directory.List([&](PathT &&Path, bool IsFile, bool IsDir)
+	{
+		Entries.emplace_back(std::move(Path), IsFile, IsDir);
+		return true;
+	});
+	std::sort(Entries.begin(), Entries.end(), [](auto const &First, auto const &Second)
+		{ return std::get<0>(First).Filename() < std::get<0>(Second).Filename(); });
+	for (auto const &Entry : Entries)
+	{
+		bool const Descend = !Settings.Before || Settings.Before(std::get<0>(Entry), std::get<1>(Entry), std::get<2>(Entry));
+		if (!std::get<2>(Entry) || !Descend) continue;
+		if (Settings.MaxDepth && (Depth + 1 >= *Settings.MaxDepth)) continue;
+		Listed = WalkOrdered(std::get<0>(Entry), Depth + 1, Settings) && Listed;
+	}
+	if (Settings.After) Settings.After(Directory);
+	return Listed;
+}
+
+bool PathElementT::Walk(WalkT const &Settings) const
+{
+	if (Settings.MaxDepth && (*Settings.MaxDepth == 0)) 
+	{
+		if (Settings.After) Settings.After(PathT(this));
+		return true;
+	}
+	if (Settings.Ordered) return WalkOrdered(PathT(this), 0, Settings);
+
+	auto const Cache = StatCacheT::Active();
+
+	std::atomic<bool> Listed{true};
+	std::function<void(std::shared_ptr<WalkDirectoryT> const &Directory)> Process;
+	auto const Finish = [&](std::shared_ptr<WalkDirectoryT> Directory)
+	{
+		while (Directory && (Directory->Pending.fetch_sub(1, std::memory_order_acq_rel) == 1))
+		{
+			if (Settings.After) Settings.After(Directory->Path);
+			Directory = Directory->Parent;
+		}
+	};
+	WorkPoolT Pool(Settings.Threads); // Destroyed first, so queued tasks never outlive Process
+	Process = [&](std::shared_ptr<WalkDirectoryT> const &Directory)
 	{
-		Callback(Enter(Element), IsFile, IsDir);
+		bool const Result = Directory->Path.List([&](PathT &&Path, bool IsFile, bool IsDir)
+		{
+			bool const Descend = !Settings.Before || Settings.Before(Path, IsFile, IsDir);
+			if (!IsDir || !Descend) return true;
+			if (Settings.MaxDepth && (Directory->Depth + 1 >= *Settings.MaxDepth)) return true;
+			Directory->Pending.fetch_add(1, std::memory_order_relaxed);
+			auto Child = std::make_shared<WalkDirectoryT>(Path, Directory->Depth + 1, Directory);
+			Pool.Push([&Process, Cache, Child](void) 
+			{ 
+				StatCacheT::ScopeT Scope(Cache);
+				Process(Child); 
+			});
+			return true;
+		});
+		if (!Result) Listed = false;
+		Finish(Directory);
+	};
+	auto Root = std::make_shared<WalkDirectoryT>(PathT(this), 0, nullptr);
+	Pool.Push([&Process, Cache, Root](void) 
+	{ 
+		StatCacheT::ScopeT Scope(Cache);
+		Process(Root); 
 	});
+	Root = nullptr;
+	Pool.Wait();
+	return Listed;
 }
 
 bool PathElementT::Delete(void) const
 {
+	InvalidateStatT const Invalidate{this, InvalidateStatT::ExtentT::Path};
 #ifdef _WIN32
-	return _wunlink(&ToNativeString(Render())[0]) == 0;
+	return FILESYSTEM_TIMED(Unlink, _wunlink(&ToNativeString(Render())[0])) == 0;
 #else
-	return unlink(Render().c_str()) == 0;
+	return FILESYSTEM_TIMED(Unlink, WithRendered(this, [](char const *Rendered) { return unlink(Rendered); })) == 0;
 #endif
 }
 
-bool PathElementT::DeleteDirectory(void) const
+#ifndef _WIN32
+namespace
+{
+	struct DeleteDirectoryT
+	{
+		std::shared_ptr<DeleteDirectoryT> Parent; // Null for the top, whose parent the caller holds open
+		std::string Name;
+		PathT Path;
+		int Descriptor = -1;
+		bool Held = false; // Descriptor stays open for the children, otherwise they reopen it
+		dev_t Device = 0; // Identity, to check reopening by path finds the same directory
+		ino_t Inode = 0;
+		bool Missing = false;
+		std::atomic<size_t> Pending{1};
+		std::atomic<bool> Failed{false};
+
+		DeleteDirectoryT(std::shared_ptr<DeleteDirectoryT> const &Parent, std::string const &Name, PathT const &Path) :
+			Parent(Parent), Name(Name), Path(Path) { }
+	};
+}
+
+static bool DeleteTree(int ParentDescriptor, std::string const &Name, PathT const &Path, DeleteFailureT const &Failure, size_t Threads)
 {
-	bool Failed = false;
-	std::list<std::pair<PathT, bool>> Directories{{PathT(this), false}};
-	while (!Directories.empty())
+	// Each directory is a task that unlinks its entries relative to its own descriptor, then
+	// the last of it and its subdirectories to finish removes it from its parent.  A
+	// directory with subdirectories holds its descriptor open for them until they finish,
+	// up to a quarter of the descriptor limit; past that it's closed after listing, and
+	// reopened by path (checking its identity) when a subdirectory needs it.  Running out
+	// of descriptors anyway requeues the directory while others are still open to close.
+	size_t HeldLimit = 1 << 16;
+	rlimit Limit;
+	if ((getrlimit(RLIMIT_NOFILE, &Limit) == 0) && (Limit.rlim_cur != RLIM_INFINITY))
+		HeldLimit = std::max<size_t>(1, std::min<size_t>(HeldLimit, Limit.rlim_cur / 4));
+	std::atomic<size_t> Held{0}, Transient{0};
+	auto const Exhausted = [&](int Error) { return ((Error == EMFILE) || (Error == ENFILE)) && (Transient.load() > 0); };
+
+	std::mutex FailureMutex;
+	auto const Report = [&](PathT const &Path, int Error)
+	{
+		if (!Failure) return;
+		std::lock_guard<std::mutex> Lock(FailureMutex);
+		Failure(Path, Error);
+	};
+	auto const Fail = [&](DeleteDirectoryT &Directory, PathT const &Path, int Error)
+	{
+		Report(Path, Error);
+		Directory.Failed = true;
+	};
+	auto const Close = [&](int Descriptor)
+	{
+		close(Descriptor);
+		Transient.fetch_sub(1);
+	};
+
+	// Runs tasks inline until the top directory turns out to have subdirectories
+	std::unique_ptr<WorkPoolT> Pool;
+	std::vector<std::function<void(void)>> Serial;
+	auto const Schedule = [&](std::function<void(void)> &&Task)
 	{
-		if (!Directories.back().second)
+		if (Pool) Pool->Push(std::move(Task));
+		else Serial.push_back(std::move(Task));
+	};
+	auto const Requeue = [&](std::function<void(void)> &&Task)
+	{
+		std::this_thread::yield();
+		Schedule(std::move(Task));
+	};
+
+	// The descriptor of Directory's parent, and whether it was reopened for the caller to close
+	auto const ParentOf = [&](DeleteDirectoryT const &Directory, int &Out)
+	{
+		auto const &Parent = Directory.Parent;
+		if (!Parent) Out = ParentDescriptor;
+		else if (Parent->Held) Out = Parent->Descriptor;
+		else
 		{
-			Directories.back().second = true;
-			Directories.back().first.List([&](PathT &&Path, bool IsFile, bool IsDir)
+			Transient.fetch_add(1);
+			Out = FILESYSTEM_TIMED(OpenDirectory, WithRendered(Parent->Path, [](char const *Rendered)
+				{ return open(Rendered, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); }));
+			if (Out < 0)
 			{
-				if (!IsFile && !IsDir) return false; // Can't delete special files, probably
-				if (IsFile) Failed = !Path.Delete();
-				if (Failed) return false;
-				if (IsDir) Directories.push_back({std::move(Path), false});
-				return true;
-			});
-			if (Failed) return false;
+				auto const Error = errno;
+				Transient.fetch_sub(1);
+				errno = Error;
+				return false;
+			}
+			struct stat StatResultBuffer;
+			if ((fstat(Out, &StatResultBuffer) != 0) || (StatResultBuffer.st_dev != Parent->Device) || (StatResultBuffer.st_ino != Parent->Inode))
+			{
+				Close(Out);
+				Out = -1;
+				errno = ESTALE; // Replaced meanwhile
+				return false;
+			}
+			return true;
 		}
-		else
+		return false;
+	};
+
+	// Removes a directory whose entries are all gone or failed, returning the parent to
+	// finish, or null if it had to be requeued
+	std::function<void(std::shared_ptr<DeleteDirectoryT> Directory)> Finish;
+	std::function<std::shared_ptr<DeleteDirectoryT>(std::shared_ptr<DeleteDirectoryT> const &Directory)> Remove;
+	Finish = [&](std::shared_ptr<DeleteDirectoryT> Directory)
+	{
+		while (Directory && (Directory->Pending.fetch_sub(1, std::memory_order_acq_rel) == 1)) Directory = Remove(Directory);
+	};
+	Remove = [&](std::shared_ptr<DeleteDirectoryT> const &Directory) -> std::shared_ptr<DeleteDirectoryT>
+	{
+		if (Directory->Held)
 		{
-#ifdef _WIN32
-			if (RemoveDirectoryW(&ToNativeString(Directories.back().first)[0]) == 0)
-				return false;
-#else
-			if (rmdir(Directories.back().first.Render().c_str()) != 0)
-				if (errno != ENOENT) return false;
+			close(Directory->Descriptor);
+			Held.fetch_sub(1);
+		}
+		if (!Directory->Failed && !Directory->Missing)
+		{
+			int Parent;
+			auto const Reopened = ParentOf(*Directory, Parent);
+			if (Parent < 0)
+			{
+				if (Exhausted(errno))
+				{
+					Directory->Held = false;
+					Requeue([&, Directory](void) { if (auto Parent = Remove(Directory)) Finish(Parent); });
+					return nullptr;
+				}
+				if (errno != ENOENT) Fail(*Directory, Directory->Parent->Path, errno);
+				else Directory->Missing = true;
+			}
+			else
+			{
+				if ((FILESYSTEM_TIMED(RemoveDirectory, unlinkat(Parent, Directory->Name.c_str(), AT_REMOVEDIR)) != 0) && (errno != ENOENT))
+					Fail(*Directory, Directory->Path, errno);
+				if (Reopened) Close(Parent);
+			}
+		}
+		if (Directory->Failed && Directory->Parent) Directory->Parent->Failed = true;
+		return Directory->Parent;
+	};
+
+	std::function<void(std::shared_ptr<DeleteDirectoryT> const &Directory)> Process;
+	Process = [&](std::shared_ptr<DeleteDirectoryT> const &Directory)
+	{
+		int Parent;
+		auto const Reopened = ParentOf(*Directory, Parent);
+		if (Parent >= 0)
+		{
+			Transient.fetch_add(1);
+			Directory->Descriptor = FILESYSTEM_TIMED(OpenDirectory, openat(Parent, Directory->Name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+			auto const Error = errno;
+			if (Directory->Descriptor < 0) Transient.fetch_sub(1);
+			if (Reopened) Close(Parent);
+			errno = Error;
+		}
+		if (Directory->Descriptor < 0)
+		{
+			if (Exhausted(errno))
+			{
+				Requeue([&Process, Directory](void) { Process(Directory); });
+				return;
+			}
+			if (errno == ENOENT) Directory->Missing = true;
+			else Fail(*Directory, (Parent < 0) ? Directory->Parent->Path : Directory->Path, errno);
+			Finish(Directory);
+			return;
+		}
+
+		// Whether the descriptor is held is settled before any subdirectory can start
+		bool Decided = false;
+		std::vector<std::shared_ptr<DeleteDirectoryT>> Children;
+		auto const Scanned = ScanDescriptor(Directory->Descriptor, [&](DirectoryEntryT const &Entry)
+		{
+			std::string Name(Entry.Name);
+			if (Entry.Type == EntryTypeT::Directory)
+			{
+				if (!Decided)
+				{
+					Decided = true;
+					Directory->Held = Held.fetch_add(1) < HeldLimit;
+					if (Directory->Held) Transient.fetch_sub(1);
+					else
+					{
+						Held.fetch_sub(1);
+						struct stat StatResultBuffer;
+						if (fstat(Directory->Descriptor, &StatResultBuffer) != 0) 
+						{
+							Fail(*Directory, Directory->Path, errno);
+							return false;
+						}
+						Directory->Device = StatResultBuffer.st_dev;
+						Directory->Inode = StatResultBuffer.st_ino;
+					}
+				}
+				Directory->Pending.fetch_add(1, std::memory_order_relaxed);
+				auto Child = std::make_shared<DeleteDirectoryT>(Directory, Name, Directory->Path.Enter(Name));
+				if (Directory->Held) Schedule([&Process, Child](void) { Process(Child); });
+				else Children.push_back(std::move(Child));
+			}
+			else if ((FILESYSTEM_TIMED(Unlink, unlinkat(Directory->Descriptor, Name.c_str(), 0)) != 0) && (errno != ENOENT)) // Links are removed, not followed
+				Fail(*Directory, Directory->Path.Enter(Name), errno);
+			return true;
+		});
+		if (!Scanned && !Directory->Failed) Fail(*Directory, Directory->Path, errno);
+		if (!Directory->Held) Close(Directory->Descriptor);
+		for (auto &Child : Children) Schedule([&Process, Child](void) { Process(Child); });
+		Finish(Directory);
+	};
+
+	auto const Top = std::make_shared<DeleteDirectoryT>(nullptr, Name, Path);
+	Process(Top);
+	if (Threads == 0) Threads = std::max(1u, std::thread::hardware_concurrency());
+	if (Threads == 1)
+	{
+		while (!Serial.empty())
+		{
+			auto Task = std::move(Serial.back());
+			Serial.pop_back();
+			Task();
+		}
+	}
+	else if (!Serial.empty())
+	{
+		Pool = std::make_unique<WorkPoolT>(Threads);
+		for (auto &Task : Serial) Pool->Push(std::move(Task));
+		Serial.clear();
+		Pool->Wait();
+	}
+	return !Top->Failed;
+}
 #endif
-			Directories.pop_back();
+
+bool PathElementT::DeleteDirectory(void) const { return DeleteDirectory({}, 1); }
+
+bool PathElementT::DeleteDirectory(DeleteFailureT const &Failure, size_t Threads) const
+{
+	InvalidateStatT const Invalidate{this, InvalidateStatT::ExtentT::Below};
+#ifdef _WIN32
+	auto const Deleted = [&](void)
+	{
+		bool Failed = false;
+		std::list<std::pair<PathT, bool>> Directories{{PathT(this), false}};
+		while (!Directories.empty())
+		{
+			if (!Directories.back().second)
+			{
+				Directories.back().second = true;
+				auto const Directory = Directories.back().first;
+				Directory.Scan([&](DirectoryEntryT const &Entry)
+				{
+					auto Path = Directory.Enter(std::string(Entry.Name));
+					if (Entry.Type == EntryTypeT::Directory) Directories.push_back({std::move(Path), false});
+					else Failed = !Path.Delete(); // Links are removed, not followed
+					return !Failed;
+				});
+				if (Failed) return false;
+			}
+			else
+			{
+				if (FILESYSTEM_TIMED(RemoveDirectory, RemoveDirectoryW(&ToNativeString(Directories.back().first)[0])) == 0)
+					return false;
+				Directories.pop_back();
+			}
 		}
+		return true;
+	}();
+	if (!Deleted && Failure) Failure(PathT(this), 0);
+	return Deleted;
+#else
+	if (Parent.Is<PathSettingsT *>()) 
+	{
+		if (Failure) Failure(PathT(this), EBUSY);
+		return false;
 	}
-	return true;
+	auto const ParentDescriptor = OpenDirectory(Parent.Get<PathElementT const *>());
+	if (ParentDescriptor < 0) 
+	{
+		if (errno == ENOENT) return true;
+		if (Failure) Failure(PathT(this), errno);
+		return false;
+	}
+	auto const Result = DeleteTree(ParentDescriptor, Value, PathT(this), Failure, Threads);
+	close(ParentDescriptor);
+	return Result;
+#endif
 }
 
 bool PathElementT::CreateDirectory(void) const
 {
+	InvalidateStatT const Invalidate{this, InvalidateStatT::ExtentT::Ancestors};
+#ifdef _WIN32
 	std::list<PathElementT const *> Parts;
 	{
 		VariantT <PathElementT const *, PathSettingsT *> Part(this);
@@ -296,17 +1104,223 @@ bool PathElementT::CreateDirectory(void) const
 	Parts.pop_front();
 	for (auto &Part : Parts)
 	{
-#ifdef _WIN32
-		auto Result = CreateDirectoryW(&ToNativeString("\\\\?\\" + Part->Render())[0], nullptr);
+		auto Result = FILESYSTEM_TIMED(MakeDirectory, CreateDirectoryW(&ToNativeString("\\\\?\\" + Part->Render())[0], nullptr));
 		if ((Result == 0) && (GetLastError() != ERROR_ALREADY_EXISTS)) 
 			return false;
+	}
+	return true;
 #else
-		auto Result = mkdir(Part->Render().c_str(), 0777);
-		if (Result == -1 && errno != EEXIST)
+	if (Parent.Is<PathSettingsT *>()) return true;
+	auto Rendered = Render();
+	if ((FILESYSTEM_TIMED(MakeDirectory, mkdir(Rendered.c_str(), 0777)) == 0) || (errno == EEXIST)) return true;
+	if (errno != ENOENT) return false;
+
+	// Open the deepest existing ancestor (every ancestor's rendering is a prefix of this
+	// one) then create the rest relative to it
+	std::vector<PathElementT const *> Missing{this};
+	int Base = -1;
+	while (true)
+	{
+		auto const Part = Missing.back()->Parent.Get<PathElementT const *>();
+		auto const Terminated = Rendered[Part->Size];
+		Rendered[Part->Size] = 0;
+		Base = FILESYSTEM_TIMED(OpenDirectory, open(Rendered.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		Rendered[Part->Size] = Terminated;
+		if (Base >= 0) break;
+		if ((errno != ENOENT) || Part->Parent.Is<PathSettingsT *>()) return false;
+		Missing.push_back(Part);
+	}
+	while (!Missing.empty())
+	{
+		auto const &Name = Missing.back()->Value;
+		Missing.pop_back();
+		if ((FILESYSTEM_TIMED(MakeDirectory, mkdirat(Base, Name.c_str(), 0777)) != 0) && (errno != EEXIST)) break;
+		if (Missing.empty()) 
+		{
+			close(Base);
+			return true;
+		}
+		auto const Next = FILESYSTEM_TIMED(OpenDirectory, openat(Base, Name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		close(Base);
+		Base = Next;
+		if (Base < 0) return false;
+	}
+	close(Base);
+	return false;
+#endif
+}
+
+#ifndef _WIN32
+static bool CopyDescriptor(int Source, int Destination, uint64_t Size)
+{
+	FILESYSTEM_TIME(Copy);
+	// Cheapest first: share extents, then copy in the kernel, then copy through memory.
+	// Each fallback continues from the descriptors' offsets where the last one stopped.
+#ifdef FICLONE
+	if (ioctl(Destination, FICLONE, Source) == 0) return true;
+#endif
+	uint64_t Copied = 0;
+#ifdef __linux__
+	while (Copied < Size)
+	{
+		auto const Result = copy_file_range(Source, nullptr, Destination, nullptr, Size - Copied, 0);
+		if (Result <= 0) break;
+		Copied += Result;
+	}
+	while (Copied < Size)
+	{
+		auto const Result = sendfile(Destination, Source, nullptr, Size - Copied);
+		if (Result <= 0) break;
+		Copied += Result;
+	}
+#endif
+	// Also catches files that grew or that report no size, like those in /proc
+	std::vector<uint8_t> Buffer(1024 * 1024);
+	while (true)
+	{
+		auto const Read = read(Source, Buffer.data(), Buffer.size());
+		if (Read < 0)
+		{
+			if (errno == EINTR) continue;
 			return false;
+		}
+		if (Read == 0) return true;
+		for (ssize_t Written = 0; Written < Read;)
+		{
+			auto const Result = write(Destination, Buffer.data() + Written, Read - Written);
+			if (Result < 0)
+			{
+				if (errno == EINTR) continue;
+				return false;
+			}
+			Written += Result;
+		}
+	}
+}
 #endif
+
+bool PathElementT::CopyTo(PathElementT const *Destination) const
+{
+	InvalidateStatT const Invalidate{Destination, InvalidateStatT::ExtentT::Path};
+#ifdef _WIN32
+	return FILESYSTEM_TIMED(Copy, CopyFileW(&ToNativeString(Render())[0], &ToNativeString(Destination->Render())[0], FALSE));
+#else
+	auto const Source = FILESYSTEM_TIMED(Open, WithRendered(this, [](char const *Rendered) { return open(Rendered, O_RDONLY | O_CLOEXEC); }));
+	if (Source < 0) return false;
+	struct stat StatResultBuffer;
+	if (fstat(Source, &StatResultBuffer) != 0)
+	{
+		close(Source);
+		return false;
 	}
-	return true;
+	// Truncated only once it's known not to be the source, under another name or not
+	auto const Target = FILESYSTEM_TIMED(Open, WithRendered(Destination, [&](char const *Rendered) 
+		{ return open(Rendered, O_WRONLY | O_CREAT | O_CLOEXEC, StatResultBuffer.st_mode & 07777); }));
+	if (Target < 0)
+	{
+		close(Source);
+		return false;
+	}
+	struct stat TargetStatBuffer;
+	if ((fstat(Target, &TargetStatBuffer) != 0) ||
+		((TargetStatBuffer.st_dev == StatResultBuffer.st_dev) && (TargetStatBuffer.st_ino == StatResultBuffer.st_ino)) ||
+		(ftruncate(Target, 0) != 0) ||
+		(fchmod(Target, StatResultBuffer.st_mode & 07777) != 0))
+	{
+		close(Source);
+		close(Target);
+		return false;
+	}
+	auto Result = CopyDescriptor(Source, Target, StatResultBuffer.st_size);
+	close(Source);
+	if (close(Target) != 0) Result = false;
+	return Result;
+#endif
+}
+
+#ifndef _WIN32
+// Recreates the link Path as Target, replacing Target
+static bool CopyLink(PathElementT const *Path, PathElementT const *Target, size_t Size)
+{
+	std::vector<char> Link(Size + 1);
+	auto const Length = FILESYSTEM_TIMED(Link, WithRendered(Path, [&](char const *Rendered) { return readlink(Rendered, Link.data(), Link.size()); }));
+	if ((Length < 0) || (static_cast<size_t>(Length) >= Link.size())) return false;
+	Link[Length] = 0;
+	Target->Delete();
+	return FILESYSTEM_TIMED(Link, WithRendered(Target, [&](char const *Rendered) { return symlink(Link.data(), Rendered); })) == 0;
+}
+#endif
+
+static PathT Rebase(PathElementT const *Path, size_t FromDepth, PathElementT const *To)
+{
+	// Replaces the first FromDepth levels of Path with To
+	std::vector<std::string const *> Names;
+	PathT Walk(Path);
+	while (Walk.Depth() > FromDepth)
+	{
+		Names.push_back(&Walk.Filename());
+		Walk = Walk.Exit();
+	}
+	PathT Out(To);
+	for (auto Name = Names.rbegin(); Name != Names.rend(); ++Name) Out = Out.Enter(**Name);
+	return Out;
+}
+
+bool PathElementT::CopyTreeTo(PathElementT const *Destination, size_t Threads) const
+{
+	InvalidateStatT const Invalidate{Destination, InvalidateStatT::ExtentT::Below};
+	if (!Destination->CreateDirectory()) return false;
+	std::atomic<bool> Failed{false};
+	auto const Depth = Level;
+	WalkT Settings;
+	Settings.Threads = Threads;
+	Settings.Before = [&](PathT const &Path, bool IsFile, bool IsDir)
+	{
+		if (*Path == *Destination) return false; // Copying into a subdirectory of the source
+		auto const Target = Rebase(Path, Depth, Destination);
+		if (IsDir)
+		{
+			if (Target.CreateDirectory()) return true;
+			Failed = true;
+			return false;
+		}
+		if (IsFile)
+		{
+			if (!Path.CopyTo(Target)) Failed = true;
+			return true;
+		}
+#ifndef _WIN32
+		struct stat StatResultBuffer;
+		if ((FILESYSTEM_TIMED(Stat, WithRendered(Path, [&](char const *Rendered) { return lstat(Rendered, &StatResultBuffer); })) == 0) && 
+			S_ISLNK(StatResultBuffer.st_mode))
+		{
+			if (!CopyLink(Path, Target, StatResultBuffer.st_size)) Failed = true;
+			return true;
+		}
+#endif
+		Failed = true; // Pipes, sockets and devices aren't copied
+		return true;
+	};
+	if (!Walk(Settings)) return false;
+	return !Failed;
+}
+
+bool PathElementT::MoveTo(PathElementT const *Destination) const
+{
+	InvalidateStatT const InvalidateSource{this, InvalidateStatT::ExtentT::Below};
+	InvalidateStatT const InvalidateDestination{Destination, InvalidateStatT::ExtentT::Below};
+#ifdef _WIN32
+	return FILESYSTEM_TIMED(Rename, MoveFileExW(&ToNativeString(Render())[0], &ToNativeString(Destination->Render())[0], MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED));
+#else
+	auto const Target = Destination->Render();
+	if (FILESYSTEM_TIMED(Rename, WithRendered(this, [&](char const *Rendered) { return rename(Rendered, Target.c_str()); })) == 0) return true;
+	if (errno != EXDEV) return false;
+	struct stat StatResultBuffer;
+	if (WithRendered(this, [&](char const *Rendered) { return lstat(Rendered, &StatResultBuffer); }) != 0) return false;
+	if (S_ISDIR(StatResultBuffer.st_mode)) return CopyTreeTo(Destination) && DeleteDirectory();
+	if (S_ISLNK(StatResultBuffer.st_mode)) return CopyLink(this, Destination, StatResultBuffer.st_size) && Delete();
+	return CopyTo(Destination) && Delete();
+#endif
 }
 
 bool PathElementT::GoTo(void) const
@@ -314,24 +1328,37 @@ bool PathElementT::GoTo(void) const
 #ifdef _WIN32
 	return SetCurrentDirectoryW(&ToNativeString(Render())[0]);
 #else
-	return chdir(Render().c_str()) == 0;
+	return WithRendered(this, [](char const *Rendered) { return chdir(Rendered); }) == 0;
 #endif
 }
 
-PathElementT::PathElementT(PathElementT const *Parent, std::string const &Value) : Value(Value), Parent(Parent)
+PathElementT::PathElementT(PathElementT const *Parent, std::string const &Value) : 
+	Value(Value), 
+	Parent(Parent),
+	Settings(Parent->Settings),
+	Size(Parent->Size + (Parent->Parent.Is<PathSettingsT *>() ? 0 : Parent->Settings->Separator.size()) + Value.size()),
+	Level(Parent->Level + 1),
+	Fingerprint(std::hash<std::string>()(Value) ^ (Parent->Fingerprint + 0x9e3779b97f4a7c15ull + (Parent->Fingerprint << 6) + (Parent->Fingerprint >> 2)))
 {
 	Assert(Parent);
 	Assert(this->Parent.Is<PathElementT const *>());
-	++Parent->Count;
+	Parent->Count.fetch_add(1, std::memory_order_relaxed);
+	FILESYSTEM_COUNT(ElementsCreated, 1);
+}
+
+static bool HasDrive(std::string const &Raw)
+{
+	return 
+		(Raw.size() >= 2) && 
+		(((Raw[0] >= 'a') && (Raw[0] <= 'z')) || ((Raw[0] >= 'A') && (Raw[0] <= 'Z'))) && 
+		(Raw[1] == ':');
 }
 
-static std::regex const DriveRegex("^([a-zA-Z]:)(.*)$");
 PathT PathT::Absolute(std::string const &Raw)
 {
 #ifdef _WIN32
-	std::smatch DriveMatch;
-	if (!Assert(std::regex_search(Raw, DriveMatch, DriveRegex))) throw CONSTRUCTION_ERROR << "Windows absolute paths must contain drive.  This path is invalid: " << Raw;
-	return PathT(PathSettingsT{DriveMatch[1].str(), "\\"}).EnterRaw(DriveMatch[2]);
+	if (!Assert(HasDrive(Raw))) throw CONSTRUCTION_ERROR << "Windows absolute paths must contain drive.  This path is invalid: " << Raw;
+	return PathT(PathSettingsT{Raw.substr(0, 2), "\\"}).EnterRaw(Raw.substr(2));
 #else
 	return PathT(PathSettingsT{{}, std::string(1, Raw[0])}).EnterRaw(Raw);
 #endif
@@ -356,8 +1383,7 @@ PathT PathT::Qualify(std::string const &Raw)
 	if (Raw.empty()) return Here();
 	if (Raw[0] == '/') return Absolute(Raw);
 	if (Raw[0] == '\\') return Absolute(Raw);
-	std::smatch DriveMatch;
-	if (std::regex_search(Raw, DriveMatch, DriveRegex)) return Absolute(Raw);
+	if (HasDrive(Raw)) return Absolute(Raw);
 	return Here().EnterRaw(Raw);
 }
 
@@ -433,7 +1459,7 @@ PathT PathT::Temp(bool File, OptionalT<PathT> const &Base)
 	}
 
 	// Create temp file
-	static char const *Template = "/XXXXXX";
+	static char const Template[] = "/XXXXXX";
 	BaseString.insert(BaseString.end(), Template, Template + sizeof(Template));
 	AssertE(BaseString.back(), 0);
 	if (File)
@@ -446,50 +1472,35 @@ PathT PathT::Temp(bool File, OptionalT<PathT> const &Base)
 	else
 	{
 		auto Result = mkdtemp(&BaseString[0]);
-		if (Result <= 0) throw CONSTRUCTION_ERROR << "Failed to create temporary directory with template " << std::string(&BaseString[0], BaseString.size()) << ".";
+		if (Result == nullptr) throw CONSTRUCTION_ERROR << "Failed to create temporary directory with template " << std::string(&BaseString[0], BaseString.size()) << ".";
 		return Absolute(Result);
 	}
 #endif
 }
 
-PathT::PathT(PathElementT const *Element)
-#ifndef NDEBUG
-	: Element(nullptr) 
-#endif
-	{ Set(Element); }
+PathT::PathT(PathElementT const *Element) : Element(nullptr) { Set(Element); }
 
-PathT::PathT(PathSettingsT const &Settings)
-#ifndef NDEBUG
-	: Element(nullptr) 
-#endif
-	{ Set(new PathElementT(Settings)); }
+PathT::PathT(PathSettingsT const &Settings) : Element(nullptr) { Set(new PathElementT(Settings)); }
 
-PathT::PathT(void)
-#ifndef NDEBUG
-	: Element(nullptr) 
-#endif
-	{ Set(new PathElementT(PathSettingsT{{}, "/"})); }
+PathT::PathT(void) : Element(nullptr) { Set(new PathElementT(PathSettingsT{{}, "/"})); }
 
-PathT::PathT(PathT const &Other) 
-#ifndef NDEBUG
-	: Element(nullptr) 
-#endif
-	{ Set(Other.Element); }
+PathT::PathT(PathT const &Other) : Element(nullptr) { Set(Other.Element); }
+
+PathT::PathT(PathT &&Other) : Element(Other.Element) { Other.Element = nullptr; }
 
 void PathT::Set(PathElementT const *Element)
 {
+	// Acquire before releasing in case the old element is the only owner of the new one
+	Element->Count.fetch_add(1, std::memory_order_relaxed);
 	Clear();
-	Assert(!this->Element);
 	this->Element = Element;
-	Element->Count += 1;
 }
 	
 void PathT::Clear(void)
 {
 	if (Element)
 	{
-		Element->Count -= 1;
-		if (Element->Count == 0) delete Element;
+		if (Element->Count.fetch_sub(1, std::memory_order_acq_rel) == 1) delete Element;
 		Element = nullptr;
 	}
 }
@@ -501,35 +1512,190 @@ PathT::~PathT(void)
 
 PathT &PathT::operator =(PathT const &Other) { Set(Other.Element); return *this; }
 
+PathT &PathT::operator =(PathT &&Other)
+{
+	if (&Other == this) return *this;
+	Clear();
+	Element = Other.Element;
+	Other.Element = nullptr;
+	return *this;
+}
+
 PathT::operator PathElementT const *(void) const { return Element; }
 	
 PathT::operator std::string(void) const { return Render(); }
 
 std::string PathT::Render(void) const { return Element->Render(); }
+size_t PathT::RenderSize(void) const { return Element->RenderSize(); }
+void PathT::Render(char *Buffer) const { Element->Render(Buffer); }
 std::string const &PathT::Filename(void) const { return Element->Filename(); }
 std::string PathT::Directory(void) const { return Element->Directory(); }
 OptionalT<std::string> PathT::Extension(void) const { return Element->Extension(); }
 
 size_t PathT::Depth(void) const { return Element->Depth(); }
+size_t PathT::Hash(void) const { return Element->Hash(); }
 
 bool PathT::Contains(PathElementT const *Other) const { return Element->Contains(Other); }
 
+bool PathT::operator ==(PathT const &Other) const { return *Element == *Other.Element; }
+bool PathT::operator !=(PathT const &Other) const { return *Element != *Other.Element; }
+
 PathT PathT::Enter(std::string const &Value) const { return Element->Enter(Value); }
 PathT PathT::EnterRaw(std::string const &Raw) const { return Element->EnterRaw(Raw); }
 PathT PathT::Exit(void) const { return Element->Exit(); }
 
+OptionalT<StatT> PathT::Stat(void) const { return Element->Stat(); }
 bool PathT::Exists(void) const { return Element->Exists(); }
 bool PathT::FileExists(void) const { return Element->FileExists(); }
 bool PathT::DirectoryExists(void) const { return Element->DirectoryExists(); }
 
+bool PathT::Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const
+	{ return Element->Scan(Callback); }
 bool PathT::List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const
 	{ return Element->List(Callback); }
 
+bool PathT::Walk(WalkT const &Settings) const { return Element->Walk(Settings); }
+
 bool PathT::Delete(void) const { return Element->Delete(); }
 bool PathT::DeleteDirectory(void) const { return Element->DeleteDirectory(); }
+bool PathT::DeleteDirectory(DeleteFailureT const &Failure, size_t Threads) const { return Element->DeleteDirectory(Failure, Threads); }
 bool PathT::CreateDirectory(void) const { return Element->CreateDirectory(); }
 
+bool PathT::CopyTo(PathElementT const *Destination) const { return Element->CopyTo(Destination); }
+bool PathT::CopyTreeTo(PathElementT const *Destination, size_t Threads) const { return Element->CopyTreeTo(Destination, Threads); }
+bool PathT::MoveTo(PathElementT const *Destination) const { return Element->MoveTo(Destination); }
+
 bool PathT::GoTo(void) const { return Element->GoTo(); }
 
+#ifndef _WIN32
+DirectoryT DirectoryT::Open(PathT const &Path) 
+	{ return DirectoryT(Path, OpenDirectory(Path)); }
+
+DirectoryT::DirectoryT(void) : Core(-1) {}
+
+DirectoryT::DirectoryT(DirectoryT &&Other) : Base(std::move(Other.Base)), Core(Other.Core) 
+{ 
+	Other.Core = -1; 
+}
+
+DirectoryT &DirectoryT::operator =(DirectoryT &&Other)
+{
+	if (&Other == this) return *this;
+	if (Core >= 0) close(Core);
+	Base = std::move(Other.Base);
+	Core = Other.Core;
+	Other.Core = -1;
+	return *this;
+}
+
+DirectoryT::~DirectoryT(void)
+{
+	if (Core >= 0) close(Core);
+}
+
+DirectoryT::operator bool(void) const { return Core >= 0; }
+
+PathT const &DirectoryT::Path(void) const { return Base; }
+
+int DirectoryT::Descriptor(void) const { return Core; }
+
+DirectoryT DirectoryT::Enter(std::string const &Name) const
+{
+	Assert(Core >= 0);
+	return DirectoryT(Base.Enter(Name), FILESYSTEM_TIMED(OpenDirectory, openat(Core, Name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+}
+
+OptionalT<StatT> DirectoryT::Stat(std::string const &Name) const
+{
+	StatT Result;
+	if (!StatAt(Core, Name.c_str(), 0, Result)) return {};
+	return Result;
+}
+
+OptionalT<StatT> DirectoryT::LinkStat(std::string const &Name) const
+{
+	StatT Result;
+	if (!StatAt(Core, Name.c_str(), AT_SYMLINK_NOFOLLOW, Result)) return {};
+	return Result;
+}
+
+bool DirectoryT::Exists(std::string const &Name) const
+{
+	struct stat StatResultBuffer;
+	return FILESYSTEM_TIMED(Stat, fstatat(Core, Name.c_str(), &StatResultBuffer, 0)) == 0;
+}
+
+bool DirectoryT::FileExists(std::string const &Name) const
+{
+	struct stat StatResultBuffer;
+	if (FILESYSTEM_TIMED(Stat, fstatat(Core, Name.c_str(), &StatResultBuffer, 0)) != 0) return false;
+	return S_ISREG(StatResultBuffer.st_mode);
+}
+
+bool DirectoryT::DirectoryExists(std::string const &Name) const
+{
+	struct stat StatResultBuffer;
+	if (FILESYSTEM_TIMED(Stat, fstatat(Core, Name.c_str(), &StatResultBuffer, 0)) != 0) return false;
+	return S_ISDIR(StatResultBuffer.st_mode);
+}
+
+bool DirectoryT::Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const
+	{ return ScanDescriptor(Core, Callback); }
+
+bool DirectoryT::List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const
+{
+	return ScanDescriptor(Core, [&](DirectoryEntryT const &Entry)
+	{
+		return Callback(Base.Enter(std::string(Entry.Name)), Entry.Type == EntryTypeT::File, Entry.Type == EntryTypeT::Directory);
+	});
+}
+
+int DirectoryT::OpenFile(std::string const &Name, int Flags, int Mode) const
+	{ return FILESYSTEM_TIMED(Open, openat(Core, Name.c_str(), Flags | O_CLOEXEC, Mode)); }
+
+bool DirectoryT::Delete(std::string const &Name) const 
+	{ return FILESYSTEM_TIMED(Unlink, unlinkat(Core, Name.c_str(), 0)) == 0; }
+
+bool DirectoryT::DeleteDirectory(std::string const &Name, DeleteFailureT const &Failure, size_t Threads) const
+	{ return DeleteTree(Core, Name, Base.Enter(Name), Failure, Threads); }
+
+bool DirectoryT::CreateDirectory(std::string const &Name) const
+	{ return (FILESYSTEM_TIMED(MakeDirectory, mkdirat(Core, Name.c_str(), 0777)) == 0) || (errno == EEXIST); }
+
+DirectoryT::DirectoryT(PathT const &Base, int Core) : Base(Base), Core(Core)
+{
+	if (Core < 0)
+		throw CONSTRUCTION_ERROR << "Unable to open directory [" << Base << "]: " << strerror(errno);
+}
+#endif
+
+PathT PathTableT::Intern(PathT const &Path)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return InternLocked(Path);
+}
+
+PathT PathTableT::Enter(PathT const &Parent, std::string const &Value)
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return InternLocked(InternLocked(Parent).Enter(Value));
 }
 
+size_t PathTableT::Size(void) const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+	return Paths.size();
+}
+
+PathT PathTableT::InternLocked(PathT const &Path)
+{
+	auto Found = Paths.find(Path);
+	if (Found != Paths.end()) return *Found;
+	if (Path.Depth() == 0) return *Paths.insert(Path).first;
+	auto Parent = InternLocked(Path.Exit());
+	if (static_cast<PathElementT const *>(Parent) == static_cast<PathElementT const *>(Path.Exit()))
+		return *Paths.insert(Path).first;
+	return *Paths.insert(Parent.Enter(Path.Filename())).first;
+}
+
+}
@@ -4,6 +4,12 @@
 #include "../ren-cxx-basics/variant.h"
 #include "string.h"
 
+#include <atomic>
+#include <string_view>
+#include <mutex>
+#include <unordered_set>
+#include <unordered_map>
+
 namespace Filesystem
 {
 
@@ -14,41 +20,111 @@ struct PathSettingsT
 };
 
 struct PathT;
+
+enum struct EntryTypeT
+{
+	Unknown,
+	File,
+	Directory,
+	Link,
+	Pipe,
+	Socket,
+	Character,
+	Block
+};
+
+struct DirectoryEntryT
+{
+	std::string_view Name; // Only valid during the callback
+	EntryTypeT Type; // Links are reported as links, not as what they point to
+	uint64_t Inode; // 0 on Windows
+};
+
+#ifndef _WIN32
+EntryTypeT TypeFromMode(uint32_t Mode); // From a POSIX st_mode
+#endif
+
+struct StatT
+{
+	EntryTypeT Type;
+	uint64_t Size;
+	int64_t Modified; // Nanoseconds since the epoch
+	int64_t Changed; // Last metadata change, in nanoseconds since the epoch; Modified on Windows
+	uint32_t Mode;
+	uint64_t Inode; // 0 on Windows
+	uint64_t Device; // 0 on Windows
+};
+
+struct WalkT
+{
+	// Called for every entry below the root; returning false skips a directory's contents
+	std::function<bool(PathT const &Path, bool IsFile, bool IsDir)> Before;
+	// Called for every walked directory, including the root, once its contents are done
+	std::function<void(PathT const &Path)> After;
+	OptionalT<size_t> MaxDepth; // Direct children are at depth 1
+	size_t Threads = 0; // 0 for one per core.  Callbacks must be thread-safe when this isn't 1.
+	bool Ordered = false; // Walk on the calling thread, visiting entries in name order
+};
+
+// Called for each entry that couldn't be deleted, with errno (0 on Windows)
+using DeleteFailureT = std::function<void(PathT const &Path, int Error)>;
+
 struct PathElementT
 {
 	PathElementT(PathSettingsT const &Settings);
 	~PathElementT(void);
+
+	// Elements are recycled through a pool rather than the global heap
+	static void *operator new(size_t Size);
+	static void operator delete(void *Pointer);
 	
 	std::string Render(void) const;
+	size_t RenderSize(void) const;
+	void Render(char *Buffer) const; // Writes RenderSize() bytes, no terminator
 	std::string const &Filename(void) const;
 	std::string Directory(void) const;
 	OptionalT<std::string> Extension(void) const;
 
 	size_t Depth(void) const;
+	size_t Hash(void) const;
 
 	bool Contains(PathElementT const *Other) const;
+	bool operator ==(PathElementT const &Other) const;
+	bool operator !=(PathElementT const &Other) const;
 	
 	PathT Enter(std::string const &Value) const;
 	PathT EnterRaw(std::string const &Raw) const;
 	PathT Exit(void) const;
 
+	OptionalT<StatT> Stat(void) const; // Follows links, empty if missing
 	bool Exists(void) const;
 	bool FileExists(void) const;
 	bool DirectoryExists(void) const;
 
-	bool List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const;
+	bool Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const; // Return false to stop
+	bool List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const; // Return false to stop
+	bool Walk(WalkT const &Settings) const;
 
 	bool Delete(void) const;
-	bool DeleteDirectory(void) const;
+	bool DeleteDirectory(void) const; // On the calling thread
+	bool DeleteDirectory(DeleteFailureT const &Failure, size_t Threads = 0) const; // Deletes what it can, reporting the rest
 	bool CreateDirectory(void) const;
 
+	bool CopyTo(PathElementT const *Destination) const; // Replaces the destination, keeps permissions
+	bool CopyTreeTo(PathElementT const *Destination, size_t Threads = 0) const; // Links are copied as links
+	bool MoveTo(PathElementT const *Destination) const; // Copies and deletes across filesystems
+
 	bool GoTo(void) const;
 
 	private:
 		friend struct PathT;
 		std::string const Value;
-		mutable size_t Count = 0;
+		mutable std::atomic<size_t> Count{0};
 		VariantT<PathElementT const *, PathSettingsT *> const Parent;
+		PathSettingsT const *const Settings;
+		size_t const Size;
+		size_t const Level;
+		size_t const Fingerprint;
 
 		PathElementT(PathElementT const *Parent, std::string const &Value);
 };
@@ -64,9 +140,11 @@ struct PathT
 	PathT(PathSettingsT const &Settings);
 	PathT(void);
 	PathT(PathT const &Other);
+	PathT(PathT &&Other);
 	~PathT(void);
 
 	PathT &operator =(PathT const &Other);
+	PathT &operator =(PathT &&Other);
 
 	void Set(PathElementT const *Element);
 	void Clear(void);
@@ -77,38 +155,150 @@ struct PathT
 
 	// Forwarding
 	std::string Render(void) const;
+	size_t RenderSize(void) const;
+	void Render(char *Buffer) const;
 	std::string const &Filename(void) const;
 	std::string Directory(void) const;
 	OptionalT<std::string> Extension(void) const;
 
 	size_t Depth(void) const;
+	size_t Hash(void) const;
 
 	bool Contains(PathElementT const *Other) const;
+	bool operator ==(PathT const &Other) const;
+	bool operator !=(PathT const &Other) const;
 	
 	PathT Enter(std::string const &Value) const;
 	PathT EnterRaw(std::string const &Raw) const;
 	PathT Exit(void) const;
 
+	OptionalT<StatT> Stat(void) const; // Follows links, empty if missing
 	bool Exists(void) const;
 	bool FileExists(void) const;
 	bool DirectoryExists(void) const;
 
-	bool List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const;
+	bool Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const; // Return false to stop
+	bool List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const; // Return false to stop
+	bool Walk(WalkT const &Settings) const;
 
 	bool Delete(void) const;
-	bool DeleteDirectory(void) const;
+	bool DeleteDirectory(void) const; // On the calling thread
+	bool DeleteDirectory(DeleteFailureT const &Failure, size_t Threads = 0) const; // Deletes what it can, reporting the rest
 	bool CreateDirectory(void) const;
 
+	bool CopyTo(PathElementT const *Destination) const; // Replaces the destination, keeps permissions
+	bool CopyTreeTo(PathElementT const *Destination, size_t Threads = 0) const; // Links are copied as links
+	bool MoveTo(PathElementT const *Destination) const; // Copies and deletes across filesystems
+
 	bool GoTo(void) const;
 
 	private:
 		PathElementT const *Element;
 };
 
+#ifndef _WIN32
+// An open directory.  Operations on its children resolve relative to the descriptor,
+// so they skip rendering and the kernel's walk down from the root.
+struct DirectoryT
+{
+	static DirectoryT Open(PathT const &Path);
+
+	DirectoryT(void);
+	DirectoryT(DirectoryT &&Other);
+	DirectoryT(DirectoryT const &Other) = delete;
+	DirectoryT &operator =(DirectoryT &&Other);
+	DirectoryT &operator =(DirectoryT const &Other) = delete;
+	~DirectoryT(void);
+
+	operator bool(void) const;
+	PathT const &Path(void) const;
+	int Descriptor(void) const;
+
+	DirectoryT Enter(std::string const &Name) const;
+
+	OptionalT<StatT> Stat(std::string const &Name) const;
+	OptionalT<StatT> LinkStat(std::string const &Name) const; // Doesn't follow links
+	bool Exists(std::string const &Name) const;
+	bool FileExists(std::string const &Name) const;
+	bool DirectoryExists(std::string const &Name) const;
+
+	bool Scan(std::function<bool(DirectoryEntryT const &Entry)> const &Callback) const;
+	bool List(std::function<bool(PathT &&Path, bool IsFile, bool IsDir)> const &Callback) const;
+
+	int OpenFile(std::string const &Name, int Flags, int Mode = 0666) const; // Returns a descriptor or -1
+	bool Delete(std::string const &Name) const;
+	bool DeleteDirectory(std::string const &Name, DeleteFailureT const &Failure = {}, size_t Threads = 0) const;
+	bool CreateDirectory(std::string const &Name) const;
+
+	private:
+		DirectoryT(PathT const &Base, int Core);
+		PathT Base;
+		int Core;
+};
+#endif
+
 inline std::ostream &operator <<(std::ostream &Stream, Filesystem::PathT const &Value)
 	{ return Stream << Value.Render(); }
 
 }
 
+namespace std
+{
+template <> struct hash<Filesystem::PathT>
+{
+	size_t operator ()(Filesystem::PathT const &Path) const { return Path.Hash(); }
+};
+}
+
+namespace Filesystem
+{
+
+// Stat results, including missing paths, are remembered while a scope using the cache
+// is active on the thread, as are the types of listed entries on filesystems that don't
+// report them.  Walks carry the scope into their workers.  Operations through PathT
+// invalidate what they change; call Invalidate for changes made any other way.
+struct StatCacheT
+{
+	struct ScopeT
+	{
+		ScopeT(StatCacheT *Cache);
+		ScopeT(ScopeT const &Other) = delete;
+		~ScopeT(void);
+
+		private:
+			StatCacheT *Previous;
+	};
+
+	static StatCacheT *Active(void);
+
+	void Invalidate(PathT const &Path);
+	void InvalidateBelow(PathT const &Path); // The path and everything it contains
+	void Clear(void);
+	size_t Size(void) const;
+
+	private:
+		friend struct PathElementT;
+		mutable std::mutex Mutex;
+		uint64_t Generation = 0; // Bumped by invalidation, so lookups racing it don't store
+		std::unordered_map<PathT, OptionalT<StatT>> Entries;
+		std::unordered_map<PathT, EntryTypeT> Types; // Listed entries without types, not following links
+};
+
+// Equal paths interned through a table share one element, so they compare by pointer
+// and walks up the tree stop as soon as they meet.
+struct PathTableT
+{
+	PathT Intern(PathT const &Path);
+	PathT Enter(PathT const &Parent, std::string const &Value);
+	size_t Size(void) const;
+
+	private:
+		PathT InternLocked(PathT const &Path);
+		mutable std::mutex Mutex;
+		std::unordered_set<PathT> Paths;
+};
+
+}
+
 #endif
 
@@ -0,0 +1,120 @@
+#include "pool.h"
+
+#include <algorithm>
+
+namespace Filesystem
+{
+
+namespace
+{
+	thread_local WorkPoolT const *CurrentPool = nullptr;
+	thread_local size_t CurrentQueue = 0;
+}
+
+WorkPoolT::WorkPoolT(size_t Threads)
+{
+	if (Threads == 0) Threads = std::max(1u, std::thread::hardware_concurrency());
+	for (size_t Index = 0; Index < Threads; ++Index) Queues.push_back(std::make_unique<QueueT>());
+	for (size_t Index = 0; Index < Threads; ++Index) this->Threads.emplace_back([this, Index](void) { Run(Index); });
+}
+
+WorkPoolT::~WorkPoolT(void)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Stopping = true;
+	}
+	Wake.notify_all();
+	for (auto &Thread : Threads) Thread.join();
+}
+
+size_t WorkPoolT::Size(void) const { return Threads.size(); }
+
+void WorkPoolT::Push(std::function<void(void)> &&Task)
+{
+	size_t Target;
+	if (CurrentPool == this) Target = CurrentQueue;
+	else
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Target = NextQueue++ % Queues.size();
+	}
+	{
+		std::lock_guard<std::mutex> Lock(Queues[Target]->Mutex);
+		Queues[Target]->Tasks.push_back(std::move(Task));
+	}
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Queued += 1;
+		Outstanding += 1;
+	}
+	Wake.notify_one();
+}
+
+void WorkPoolT::Wait(void)
+{
+	std::unique_lock<std::mutex> Lock(Mutex);
+	Idle.wait(Lock, [&](void) { return Outstanding == 0; });
+	if (Failure)
+	{
+		auto Rethrow = Failure;
+		Failure = nullptr;
+		std::rethrow_exception(Rethrow);
+	}
+}
+
+std::function<void(void)> WorkPoolT::Take(size_t Self)
+{
+	// The caller has reserved one queued task, so keep looking until it turns up
+	while (true)
+	{
+		{
+			auto &Own = *Queues[Self];
+			std::lock_guard<std::mutex> Lock(Own.Mutex);
+			if (!Own.Tasks.empty())
+			{
+				auto Out = std::move(Own.Tasks.back());
+				Own.Tasks.pop_back();
+				return Out;
+			}
+		}
+		for (size_t Offset = 1; Offset < Queues.size(); ++Offset)
+		{
+			auto &Other = *Queues[(Self + Offset) % Queues.size()];
+			std::lock_guard<std::mutex> Lock(Other.Mutex);
+			if (!Other.Tasks.empty())
+			{
+				auto Out = std::move(Other.Tasks.front());
+				Other.Tasks.pop_front();
+				return Out;
+			}
+		}
+		std::this_thread::yield();
+	}
+}
+
+void WorkPoolT::Run(size_t Self)
+{
+	CurrentPool = this;
+	CurrentQueue = Self;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Wake.wait(Lock, [&](void) { return Stopping || (Queued > 0); });
+			if (Queued == 0) return;
+			Queued -= 1;
+		}
+		auto Task = Take(Self);
+		std::exception_ptr Thrown;
+		try { Task(); }
+		catch (...) { Thrown = std::current_exception(); }
+		Task = nullptr;
+		std::lock_guard<std::mutex> Lock(Mutex);
+		if (Thrown && !Failure) Failure = Thrown;
+		Outstanding -= 1;
+		if (Outstanding == 0) Idle.notify_all(); // Under the lock, the pool may be destroyed as soon as Wait sees this
+	}
+}
+
+}
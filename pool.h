@@ -0,0 +1,51 @@
+#ifndef ren_cxx_filesystem__pool_h
+#define ren_cxx_filesystem__pool_h
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <exception>
+
+namespace Filesystem
+{
+
+// Each worker takes tasks from the back of its own queue and steals from the front of
+// the others' when it runs dry.  Tasks pushed by a worker go to that worker's queue, so
+// recursive work stays local until someone is idle.
+struct WorkPoolT
+{
+	WorkPoolT(size_t Threads = 0); // 0 for one thread per core
+	WorkPoolT(WorkPoolT const &Other) = delete;
+	WorkPoolT &operator =(WorkPoolT const &Other) = delete;
+	~WorkPoolT(void);
+
+	size_t Size(void) const;
+	void Push(std::function<void(void)> &&Task);
+	void Wait(void); // Don't call from a task.  Rethrows the first exception thrown by a task.
+
+	private:
+		struct QueueT
+		{
+			std::mutex Mutex;
+			std::deque<std::function<void(void)>> Tasks;
+		};
+
+		void Run(size_t Self);
+		std::function<void(void)> Take(size_t Self);
+
+		std::vector<std::unique_ptr<QueueT>> Queues;
+		std::vector<std::thread> Threads;
+		std::mutex Mutex;
+		std::condition_variable Wake, Idle;
+		size_t Queued = 0, Outstanding = 0, NextQueue = 0;
+		bool Stopping = false;
+		std::exception_ptr Failure;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "record.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILESYSTEM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace Filesystem
+{
+
+typedef uint8_t const *FindT(uint8_t const *Data, size_t Size, uint8_t Delimiter);
+
+static uint8_t const *FindScalar(uint8_t const *Data, size_t Size, uint8_t Delimiter)
+{
+	return static_cast<uint8_t const *>(memchr(Data, Delimiter, Size));
+}
+
+#ifdef FILESYSTEM_X86_KERNELS
+__attribute__((target("sse2")))
+static uint8_t const *FindSSE2(uint8_t const *Data, size_t Size, uint8_t Delimiter)
+{
+	auto const Needle = _mm_set1_epi8(static_cast<char>(Delimiter));
+	size_t Index = 0;
+	for (; Index + 16 <= Size; Index += 16)
+	{
+		auto const Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128(reinterpret_cast<__m128i const *>(Data + Index)), Needle));
+		if (Mask != 0) return Data + Index + __builtin_ctz(Mask);
+	}
+	for (; Index < Size; ++Index) 
+		if (Data[Index] == Delimiter) return Data + Index;
+	return nullptr;
+}
+
+__attribute__((target("avx2")))
+static uint8_t const *FindAVX2(uint8_t const *Data, size_t Size, uint8_t Delimiter)
+{
+	auto const Needle = _mm256_set1_epi8(static_cast<char>(Delimiter));
+	size_t Index = 0;
+	// Two vectors per iteration; most log lines are longer than one
+	for (; Index + 64 <= Size; Index += 64)
+	{
+		auto const First = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(Data + Index)), Needle);
+		auto const Second = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(Data + Index + 32)), Needle);
+		auto const Mask = 
+			static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(First))) |
+			(static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(Second))) << 32);
+		if (Mask != 0) return Data + Index + __builtin_ctzll(Mask);
+	}
+	for (; Index + 32 <= Size; Index += 32)
+	{
+		auto const Mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256(reinterpret_cast<__m256i const *>(Data + Index)), Needle)));
+		if (Mask != 0) return Data + Index + __builtin_ctz(Mask);
+	}
+	return FindSSE2(Data + Index, Size - Index, Delimiter);
+}
+#endif
+
+static std::pair<FindT *, char const *> SelectKernel(void)
+{
+#ifdef FILESYSTEM_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return {FindAVX2, "avx2"};
+	if (__builtin_cpu_supports("sse2")) return {FindSSE2, "sse2"};
+#endif
+	return {FindScalar, "scalar"};
+}
+
+// Not a namespace-scope static, which records split by other static initializers could
+// find still null
+static std::pair<FindT *, char const *> const &Kernel(void)
+{
+	static auto const Selected = SelectKernel();
+	return Selected;
+}
+
+uint8_t const *FindDelimiter(uint8_t const *Data, size_t Size, uint8_t Delimiter)
+	{ return Kernel().first(Data, Size, Delimiter); }
+
+char const *DelimiterKernel(void) { return Kernel().second; }
+
+RecordReaderT::RecordReaderT(SourceT &&Source, uint8_t Delimiter, ReadBufferT &&Buffer) :
+	Source(std::move(Source)),
+	Buffer(std::move(Buffer)),
+	Delimiter(Delimiter),
+	Memory(nullptr),
+	MemoryStop(nullptr),
+	Pending(0),
+	Scanned(0),
+	Ended(false)
+{
+}
+
+RecordReaderT::RecordReaderT(FileT &File, uint8_t Delimiter, ReadBufferT &&Buffer) :
+	RecordReaderT([&File](ReadBufferT &Buffer) { return File.Read(Buffer); }, Delimiter, std::move(Buffer))
+{
+}
+
+#ifndef _WIN32
+RecordReaderT::RecordReaderT(RawFileT &File, uint8_t Delimiter, ReadBufferT &&Buffer) :
+	RecordReaderT([&File](ReadBufferT &Buffer) { return File.Read(Buffer); }, Delimiter, std::move(Buffer))
+{
+}
+#endif
+
+RecordReaderT::RecordReaderT(MappedFileT const &File, uint8_t Delimiter) :
+	RecordReaderT(File.Data(), File.Size(), Delimiter)
+{
+}
+
+RecordReaderT::RecordReaderT(void const *Data, size_t Size, uint8_t Delimiter) :
+	RecordReaderT(SourceT(), Delimiter, ReadBufferT(1))
+{
+	Memory = static_cast<uint8_t const *>(Data);
+	MemoryStop = Memory + Size;
+}
+
+bool RecordReaderT::Next(std::string_view &Record)
+{
+	if (!Source)
+	{
+		if (Memory == MemoryStop) return false;
+		auto Stop = FindDelimiter(Memory, MemoryStop - Memory, Delimiter);
+		Record = std::string_view(reinterpret_cast<char const *>(Memory), (Stop ? Stop : MemoryStop) - Memory);
+		Memory = Stop ? Stop + 1 : MemoryStop;
+		return true;
+	}
+
+	if (Pending > 0)
+	{
+		Buffer.Consume(Pending);
+		Pending = 0;
+	}
+	while (true)
+	{
+		auto const Start = Buffer.FilledStart();
+		auto const Found = FindDelimiter(Start + Scanned, Buffer.Filled() - Scanned, Delimiter);
+		if (Found)
+		{
+			Record = std::string_view(reinterpret_cast<char const *>(Start), Found - Start);
+			Pending = Record.size() + 1;
+			Scanned = 0;
+			return true;
+		}
+		Scanned = Buffer.Filled();
+		if (!Ended && !Source(Buffer)) Ended = true;
+		if (Ended)
+		{
+			if (Buffer.Filled() == 0) return false;
+			Record = std::string_view(reinterpret_cast<char const *>(Buffer.FilledStart()), Buffer.Filled());
+			Pending = Record.size();
+			Scanned = 0;
+			return true;
+		}
+	}
+}
+
+}
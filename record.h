@@ -0,0 +1,49 @@
+#ifndef ren_cxx_filesystem__record_h
+#define ren_cxx_filesystem__record_h
+
+#include "file.h"
+
+#include <functional>
+#include <string_view>
+
+namespace Filesystem
+{
+
+// First Delimiter in [Data, Data + Size), or nullptr.  Uses the widest vector kernel the
+// processor supports.
+uint8_t const *FindDelimiter(uint8_t const *Data, size_t Size, uint8_t Delimiter);
+char const *DelimiterKernel(void); // Name of the kernel FindDelimiter picked
+
+// Splits a file into records on a delimiter byte.  Records are views into the reader's
+// storage (or the mapping) without the delimiter, valid until the next call to Next.
+// Records crossing read boundaries are kept whole; the buffer grows to fit the longest.
+// A final record without a delimiter is still returned.
+struct RecordReaderT
+{
+	using SourceT = std::function<bool(ReadBufferT &Buffer)>; // Fills Buffer, false at the end
+
+	RecordReaderT(SourceT &&Source, uint8_t Delimiter = '\n', ReadBufferT &&Buffer = ReadBufferT(65536));
+	RecordReaderT(FileT &File, uint8_t Delimiter = '\n', ReadBufferT &&Buffer = ReadBufferT(65536));
+#ifndef _WIN32
+	RecordReaderT(RawFileT &File, uint8_t Delimiter = '\n', ReadBufferT &&Buffer = ReadBufferT(65536));
+#endif
+	RecordReaderT(MappedFileT const &File, uint8_t Delimiter = '\n'); // File must outlive the reader
+	RecordReaderT(void const *Data, size_t Size, uint8_t Delimiter = '\n');
+	RecordReaderT(RecordReaderT const &Other) = delete;
+	RecordReaderT &operator =(RecordReaderT const &Other) = delete;
+
+	bool Next(std::string_view &Record);
+
+	private:
+		SourceT Source; // Empty when reading from memory
+		ReadBufferT Buffer;
+		uint8_t const Delimiter;
+		uint8_t const *Memory, *MemoryStop;
+		size_t Pending; // Bytes of the last record, consumed on the next call
+		size_t Scanned; // Filled bytes known not to contain a delimiter
+		bool Ended;
+};
+
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include "snapshot.h"
+
+#ifndef _WIN32
+
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <type_traits>
+
+#include "atomicwrite.h"
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+static_assert(sizeof(SnapshotEntryT) == 56, "Snapshot entries are saved as is");
+static_assert(std::is_trivially_copyable<SnapshotEntryT>::value, "Snapshot entries are saved as is");
+
+namespace
+{
+	// Saved in native byte order; a file from another byte order fails the version check
+	struct HeaderT
+	{
+		char Magic[8];
+		uint32_t Version;
+		uint32_t EntrySize;
+		uint64_t Count;
+		uint64_t NamesSize;
+		int64_t Taken;
+	};
+
+	char const Magic[8] = {'r', 'e', 'n', 's', 'n', 'a', 'p', '\0'};
+	uint32_t const Version = 1;
+
+	// Slack for filesystems whose timestamps are coarser than the clock
+	int64_t const RacyMargin = 2000000000;
+
+	int64_t Now(void)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	bool Differs(SnapshotEntryT const &Entry, StatT const &Stat)
+	{
+		return
+			(Entry.Size != Stat.Size) ||
+			(Entry.Modified != Stat.Modified) ||
+			(Entry.Changed != Stat.Changed) ||
+			(Entry.Inode != Stat.Inode);
+	}
+}
+
+struct SnapshotT::BuilderT
+{
+	BuilderT(SnapshotT const *Old, SnapshotDiffT *Diff, bool StatUnchanged) :
+		Old(Old), Diff(Diff), StatUnchanged(StatUnchanged) { }
+
+	SnapshotT Run(PathT const &Root)
+	{
+		SnapshotT Out;
+		Out.Time = Now();
+		Out.RootPath = Root;
+
+		auto Directory = DirectoryT::Open(Root);
+		if (!Directory) throw CONSTRUCTION_ERROR << "Unable to open directory [" << Root << "]: " << strerror(errno);
+		auto const Stat = Directory.LinkStat(".");
+		if (!Stat) throw CONSTRUCTION_ERROR << "Unable to stat directory [" << Root << "]: " << strerror(errno);
+		Add(0, Root.Render(), *Stat);
+		// The root is always compared by name, even if it was replaced
+		if (Old) Queue.push_back({0, Root, 0});
+		else Queue.push_back({0, Root, {}});
+
+		while (!Queue.empty())
+		{
+			auto Next = std::move(Queue.front());
+			Queue.pop_front();
+			Visit(Next);
+		}
+
+		Out.OwnedEntries = std::move(Entries);
+		Out.OwnedNames = std::move(Names);
+		Out.Entries = Out.OwnedEntries.data();
+		Out.Names = Out.OwnedNames.data();
+		Out.EntryCount = Out.OwnedEntries.size();
+		Out.NamesSize = Out.OwnedNames.size();
+		return Out;
+	}
+
+	private:
+		struct QueuedT
+		{
+			uint32_t Index;
+			PathT Path;
+			OptionalT<uint32_t> Old; // The same directory in the old snapshot
+		};
+
+		struct ChildT
+		{
+			std::string Name;
+			StatT Stat;
+		};
+
+		uint32_t Add(uint32_t Parent, std::string_view Name, StatT const &Stat)
+		{
+			if ((Entries.size() >= UINT32_MAX) || (Names.size() + Name.size() > UINT32_MAX))
+				throw SYSTEM_ERROR << "Tree is too large to snapshot";
+			SnapshotEntryT Entry{};
+			Entry.Parent = Parent;
+			Entry.NameOffset = static_cast<uint32_t>(Names.size());
+			Entry.NameSize = static_cast<uint32_t>(Name.size());
+			Entry.Type = Stat.Type;
+			Entry.Size = Stat.Size;
+			Entry.Modified = Stat.Modified;
+			Entry.Changed = Stat.Changed;
+			Entry.Inode = Stat.Inode;
+			Names.insert(Names.end(), Name.begin(), Name.end());
+			Entries.push_back(Entry);
+			return static_cast<uint32_t>(Entries.size() - 1);
+		}
+
+		// Everything the old snapshot had inside a directory that's gone
+		void RemoveBelow(size_t OldIndex, PathT const &Path)
+		{
+			auto const &Entry = (*Old)[OldIndex];
+			for (size_t Child = Entry.FirstChild; Child < Entry.FirstChild + Entry.ChildCount; ++Child)
+			{
+				auto const ChildPath = Path.Enter(std::string(Old->Name(Child)));
+				Diff->Removed.push_back(ChildPath);
+				if ((*Old)[Child].Type == EntryTypeT::Directory) RemoveBelow(Child, ChildPath);
+			}
+		}
+
+		void Visit(QueuedT const &Queued)
+		{
+			auto const Entry = Entries[Queued.Index];
+			SnapshotEntryT const *Previous = Queued.Old ? &(*Old)[*Queued.Old] : nullptr;
+			bool const Unchanged =
+				Previous &&
+				(Previous->Type == EntryTypeT::Directory) &&
+				(Previous->Modified == Entry.Modified) &&
+				(Previous->Changed == Entry.Changed) &&
+				(Previous->Inode == Entry.Inode) &&
+				(Entry.Modified < Old->Time - RacyMargin);
+
+			// Opened only when something needs a stat or listing
+			DirectoryT Directory;
+			bool Opened = false;
+			auto const Open = [&](void) -> DirectoryT const &
+			{
+				if (!Opened) Directory = DirectoryT::Open(Queued.Path);
+				Opened = true;
+				return Directory;
+			};
+
+			std::vector<ChildT> Children;
+			if (Unchanged)
+			{
+				for (size_t Child = Previous->FirstChild; Child < Previous->FirstChild + Previous->ChildCount; ++Child)
+				{
+					auto const &Recorded = (*Old)[Child];
+					std::string Name(Old->Name(Child));
+					// Directories are always restatted, since their contents may have changed
+					if (!StatUnchanged && (Recorded.Type != EntryTypeT::Directory))
+					{
+						StatT Stat{};
+						Stat.Type = Recorded.Type;
+						Stat.Size = Recorded.Size;
+						Stat.Modified = Recorded.Modified;
+						Stat.Changed = Recorded.Changed;
+						Stat.Inode = Recorded.Inode;
+						Children.push_back({std::move(Name), Stat});
+						continue;
+					}
+					if (!Open()) break;
+					auto const Stat = Directory.LinkStat(Name);
+					if (Stat) Children.push_back({std::move(Name), *Stat});
+				}
+			}
+			else if (Open())
+			{
+				std::vector<std::string> Listed;
+				Directory.Scan([&](DirectoryEntryT const &Child)
+				{
+					Listed.emplace_back(Child.Name);
+					return true;
+				});
+				std::sort(Listed.begin(), Listed.end());
+				Children.reserve(Listed.size());
+				for (auto &Name : Listed)
+				{
+					auto const Stat = Directory.LinkStat(Name); // Skips entries deleted since the listing
+					if (Stat) Children.push_back({std::move(Name), *Stat});
+				}
+			}
+
+			Entries[Queued.Index].FirstChild = static_cast<uint32_t>(Entries.size());
+			Entries[Queued.Index].ChildCount = static_cast<uint32_t>(Children.size());
+			size_t Matched = Previous ? Previous->FirstChild : 0;
+			size_t const MatchedEnd = Previous ? Previous->FirstChild + Previous->ChildCount : 0;
+			for (auto const &Child : Children)
+			{
+				auto const Index = Add(Queued.Index, Child.Name, Child.Stat);
+				bool const IsDirectory = Child.Stat.Type == EntryTypeT::Directory;
+				if (!Diff)
+				{
+					if (IsDirectory) Queue.push_back({Index, Queued.Path.Enter(Child.Name), {}});
+					continue;
+				}
+
+				// Both listings are sorted, so old entries before this name are gone
+				auto const Path = Queued.Path.Enter(Child.Name);
+				for (; (Matched < MatchedEnd) && (Old->Name(Matched) < Child.Name); ++Matched)
+				{
+					auto const Gone = Queued.Path.Enter(std::string(Old->Name(Matched)));
+					Diff->Removed.push_back(Gone);
+					if ((*Old)[Matched].Type == EntryTypeT::Directory) RemoveBelow(Matched, Gone);
+				}
+				if ((Matched < MatchedEnd) && (Old->Name(Matched) == Child.Name))
+				{
+					auto const &Recorded = (*Old)[Matched];
+					if (Recorded.Type != Child.Stat.Type)
+					{
+						Diff->Removed.push_back(Path);
+						if (Recorded.Type == EntryTypeT::Directory) RemoveBelow(Matched, Path);
+						Diff->Added.push_back(Path);
+						if (IsDirectory) Queue.push_back({Index, Path, {}});
+					}
+					else if (IsDirectory) Queue.push_back({Index, Path, static_cast<uint32_t>(Matched)});
+					else if (Differs(Recorded, Child.Stat)) Diff->Modified.push_back(Path);
+					++Matched;
+					continue;
+				}
+				Diff->Added.push_back(Path);
+				if (IsDirectory) Queue.push_back({Index, Path, {}});
+			}
+			if (Diff)
+			{
+				for (; Matched < MatchedEnd; ++Matched)
+				{
+					auto const Gone = Queued.Path.Enter(std::string(Old->Name(Matched)));
+					Diff->Removed.push_back(Gone);
+					if ((*Old)[Matched].Type == EntryTypeT::Directory) RemoveBelow(Matched, Gone);
+				}
+			}
+		}
+
+		SnapshotT const *const Old;
+		SnapshotDiffT *const Diff;
+		bool const StatUnchanged;
+		std::vector<SnapshotEntryT> Entries;
+		std::vector<char> Names;
+		std::deque<QueuedT> Queue;
+};
+
+bool SnapshotDiffT::Empty(void) const { return Added.empty() && Removed.empty() && Modified.empty(); }
+
+SnapshotT::SnapshotT(void) : Time(0), Entries(nullptr), Names(nullptr), EntryCount(0), NamesSize(0) {}
+
+SnapshotT SnapshotT::Scan(PathT const &Root) { return BuilderT(nullptr, nullptr, true).Run(Root); }
+
+OptionalT<SnapshotT> SnapshotT::Load(PathT const &File)
+{
+	if (!File.FileExists()) return {};
+	SnapshotT Out;
+	Out.Mapped = MappedFileT::Open(File);
+	auto const Data = Out.Mapped.Data();
+	auto const Size = Out.Mapped.Size();
+
+	HeaderT Header;
+	if (Size < sizeof(Header)) return {};
+	memcpy(&Header, Data, sizeof(Header));
+	if (memcmp(Header.Magic, Magic, sizeof(Magic)) != 0) return {};
+	if (Header.Version != Version) return {};
+	if (Header.EntrySize != sizeof(SnapshotEntryT)) return {};
+	if ((Header.Count == 0) || (Header.Count > (Size - sizeof(Header)) / sizeof(SnapshotEntryT))) return {};
+	if (Header.NamesSize != Size - sizeof(Header) - Header.Count * sizeof(SnapshotEntryT)) return {};
+
+	// The header keeps entries 8-byte aligned within the page-aligned mapping
+	Out.Entries = reinterpret_cast<SnapshotEntryT const *>(Data + sizeof(Header));
+	Out.Names = reinterpret_cast<char const *>(Data + sizeof(Header) + Header.Count * sizeof(SnapshotEntryT));
+	Out.EntryCount = Header.Count;
+	Out.NamesSize = Header.NamesSize;
+	Out.Time = Header.Taken;
+	for (size_t Index = 0; Index < Out.EntryCount; ++Index)
+	{
+		auto const &Entry = Out.Entries[Index];
+		if (Entry.Parent >= Out.EntryCount) return {};
+		if (static_cast<uint64_t>(Entry.FirstChild) + Entry.ChildCount > Out.EntryCount) return {};
+		if ((Entry.ChildCount > 0) && (Entry.FirstChild <= Index)) return {}; // Children come after their parent
+		if (static_cast<uint64_t>(Entry.NameOffset) + Entry.NameSize > Out.NamesSize) return {};
+		if ((Entry.Type < EntryTypeT::Unknown) || (Entry.Type > EntryTypeT::Block)) return {};
+		// Parents come first and list exactly their children, so Path and Find terminate
+		if ((Index == 0) ? (Entry.Parent != 0) : (Entry.Parent >= Index)) return {};
+		auto const &Parent = Out.Entries[Entry.Parent];
+		if ((Index > 0) && ((Index < Parent.FirstChild) || (Index >= static_cast<uint64_t>(Parent.FirstChild) + Parent.ChildCount))) return {};
+		for (size_t Child = Entry.FirstChild; Child < static_cast<uint64_t>(Entry.FirstChild) + Entry.ChildCount; ++Child)
+			if (Out.Entries[Child].Parent != Index) return {};
+	}
+	auto const Root = Out.Name(0);
+	if (Root.empty() || (Root[0] != '/')) return {};
+	Out.RootPath = PathT::Absolute(std::string(Root));
+	return Out;
+}
+
+void SnapshotT::Save(PathT const &File) const
+{
+	HeaderT Header{};
+	memcpy(Header.Magic, Magic, sizeof(Magic));
+	Header.Version = Version;
+	Header.EntrySize = sizeof(SnapshotEntryT);
+	Header.Count = EntryCount;
+	Header.NamesSize = NamesSize;
+	Header.Taken = Time;
+	auto Write = AtomicWriteT::Open(File);
+	Write.File().Write({
+		WriteSpanT(&Header, sizeof(Header)),
+		WriteSpanT(Entries, EntryCount * sizeof(SnapshotEntryT)),
+		WriteSpanT(Names, NamesSize)});
+	Write.Commit();
+}
+
+SnapshotT SnapshotT::Rescan(SnapshotDiffT &Diff, bool StatUnchanged) const
+{
+	Diff = {};
+	return BuilderT(this, &Diff, StatUnchanged).Run(RootPath);
+}
+
+PathT const &SnapshotT::Root(void) const { return RootPath; }
+
+int64_t SnapshotT::Taken(void) const { return Time; }
+
+size_t SnapshotT::Count(void) const { return EntryCount; }
+
+SnapshotEntryT const &SnapshotT::operator [](size_t Index) const
+{
+	Assert(Index < EntryCount);
+	return Entries[Index];
+}
+
+std::string_view SnapshotT::Name(size_t Index) const
+{
+	auto const &Entry = (*this)[Index];
+	return std::string_view(Names + Entry.NameOffset, Entry.NameSize);
+}
+
+PathT SnapshotT::Path(size_t Index) const
+{
+	if (Index == 0) return RootPath;
+	return Path((*this)[Index].Parent).Enter(std::string(Name(Index)));
+}
+
+OptionalT<size_t> SnapshotT::Find(PathT const &Path) const
+{
+	if (!RootPath.Contains(Path)) return {};
+	std::vector<std::string> Steps;
+	for (PathT At = Path; At.Depth() > RootPath.Depth(); At = At.Exit()) Steps.push_back(At.Filename());
+
+	size_t Index = 0;
+	for (auto Step = Steps.rbegin(); Step != Steps.rend(); ++Step)
+	{
+		auto const &Entry = Entries[Index];
+		if (Entry.Type != EntryTypeT::Directory) return {};
+		size_t const End = Entry.FirstChild + Entry.ChildCount;
+		size_t Low = Entry.FirstChild, High = End;
+		while (Low < High)
+		{
+			auto const Middle = Low + (High - Low) / 2;
+			if (this->Name(Middle) < *Step) Low = Middle + 1;
+			else High = Middle;
+		}
+		if ((Low == End) || (this->Name(Low) != *Step)) return {};
+		Index = Low;
+	}
+	return Index;
+}
+
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef ren_cxx_filesystem__snapshot_h
+#define ren_cxx_filesystem__snapshot_h
+
+#include "path.h"
+#include "file.h"
+
+#include <vector>
+
+#ifndef _WIN32
+namespace Filesystem
+{
+
+// One entry of a snapshot, fixed size so saved snapshots are used straight from the
+// mapping.  Entries are laid out breadth first: the root is entry 0, and the children of
+// each directory are contiguous and sorted by name.
+struct SnapshotEntryT
+{
+	uint32_t Parent; // The root is its own parent
+	uint32_t FirstChild;
+	uint32_t ChildCount;
+	uint32_t NameOffset;
+	uint32_t NameSize;
+	EntryTypeT Type; // Links are recorded as links
+	uint64_t Size;
+	int64_t Modified;
+	int64_t Changed;
+	uint64_t Inode;
+};
+
+struct SnapshotDiffT
+{
+	std::vector<PathT> Added; // Including everything inside added directories
+	std::vector<PathT> Removed; // Including everything inside removed directories
+	std::vector<PathT> Modified; // Non-directories whose size, times or inode changed
+
+	bool Empty(void) const;
+};
+
+// The entries of a tree as of a scan.  Rescan compares against the tree as it is now,
+// listing only directories whose times changed since the snapshot; the others reuse the
+// recorded listing.  Directories modified within a couple of seconds of the scan are
+// always relisted, since their times may not have moved since.
+struct SnapshotT
+{
+	static SnapshotT Scan(PathT const &Root);
+	static OptionalT<SnapshotT> Load(PathT const &File); // Empty if missing or not a valid snapshot
+
+	// Both storages keep their buffers when moved, so the views stay valid
+	SnapshotT(SnapshotT &&Other) = default;
+	SnapshotT(SnapshotT const &Other) = delete;
+	SnapshotT &operator =(SnapshotT &&Other) = default;
+	SnapshotT &operator =(SnapshotT const &Other) = delete;
+
+	void Save(PathT const &File) const; // Replaces the file atomically
+
+	// Replaces Diff with the changes since this snapshot.  StatUnchanged restats entries in
+	// unchanged directories, to find modified files; without it only entries in relisted
+	// directories are compared.
+	SnapshotT Rescan(SnapshotDiffT &Diff, bool StatUnchanged = true) const;
+
+	PathT const &Root(void) const;
+	int64_t Taken(void) const; // When the scan started, in nanoseconds since the epoch
+	size_t Count(void) const;
+	SnapshotEntryT const &operator [](size_t Index) const;
+	std::string_view Name(size_t Index) const;
+	PathT Path(size_t Index) const;
+	OptionalT<size_t> Find(PathT const &Path) const;
+
+	private:
+		struct BuilderT;
+		SnapshotT(void);
+
+		PathT RootPath;
+		int64_t Time;
+		MappedFileT Mapped;
+		std::vector<SnapshotEntryT> OwnedEntries;
+		std::vector<char> OwnedNames;
+		SnapshotEntryT const *Entries;
+		char const *Names;
+		size_t EntryCount;
+		size_t NamesSize;
+};
+
+}
+#endif
+
+#endif
@@ -0,0 +1,548 @@
+#include <cassert>
+#include <iostream>
+
+#include "../path.h"
+#include "../file.h"
+#include "../async.h"
+#include "../record.h"
+#include "../atomicwrite.h"
+#include "../watch.h"
+#include "../hash.h"
+
+#include <fcntl.h>
+
+int main(int, char **)
+{
+	auto const Scratch = Filesystem::PathT::Temp(false);
+
+	std::string Text;
+	for (size_t Line = 0; Line < 10000; ++Line) Text += "line " + std::to_string(Line) + "\n";
+	auto const TextPath = Scratch.Enter("text.txt");
+	Filesystem::FileT::OpenWrite(TextPath).Write(Text);
+
+	// Mapping
+	{
+		auto Mapped = Filesystem::MappedFileT::Open(TextPath);
+		Assert(Mapped.Mapped());
+		Mapped.AdviseSequential();
+		Mapped.AdviseWillNeed(4097, 100);
+		AssertE(std::string(reinterpret_cast<char const *>(Mapped.Data()), Mapped.Size()), Text);
+		auto Moved = std::move(Mapped);
+		AssertE(Moved.Size(), Text.size());
+		AssertE(Mapped.Size(), 0u);
+
+		auto const EmptyPath = Scratch.Enter("empty");
+		{ auto Created = Filesystem::FileT::OpenWrite(EmptyPath); }
+		auto Empty = Filesystem::MappedFileT::Open(EmptyPath);
+		Assert(!Empty.Mapped());
+		AssertE(Empty.Size(), 0u);
+	}
+
+	// Read buffers
+	{
+		auto const All = Filesystem::FileT::OpenRead(TextPath).ReadAll();
+		AssertE(std::string(All.begin(), All.end()), Text);
+
+		ReadBufferT Limited(16, 64);
+		Limited.Ensure(64);
+		AssertE(Limited.Capacity(), 64u);
+		Limited.Fill(60);
+		Limited.Consume(40);
+		Limited.Ensure(40);
+		AssertE(Limited.Filled(), 20u);
+		bool Threw = false;
+		try { Limited.Ensure(45); } catch (...) { Threw = true; }
+		Assert(Threw);
+
+		ReadBufferT::PoolT Pool(128);
+		{
+			ReadBufferT Pooled(Pool);
+			AssertE(Pooled.Capacity(), 128u);
+			Pooled.Ensure(1000);
+			Assert(Pooled.Capacity() >= 1000u);
+		}
+		ReadBufferT Reused(Pool);
+
+		auto Ring = ReadBufferT::Ring(4096);
+		auto const Size = Ring.Capacity();
+		auto Raw = Filesystem::RawFileT::OpenRead(TextPath);
+		std::string Copied;
+		while (Raw.Read(Ring))
+		{
+			// Leave a partial line behind so the filled region wraps
+			auto const Filled = std::string(reinterpret_cast<char const *>(Ring.FilledStart()), Ring.Filled());
+			auto const Keep = Filled.size() - (Filled.rfind('\n') + 1);
+			Copied += Filled.substr(0, Filled.size() - Keep);
+			Ring.Consume(Filled.size() - Keep);
+			AssertE(Ring.Capacity(), Size);
+		}
+		AssertE(Copied, Text);
+	}
+
+	// Raw descriptors
+	{
+		auto Raw = Filesystem::RawFileT::OpenRead(TextPath);
+		AssertE(Raw.Size(), Text.size());
+		char Piece[4];
+		AssertE(Raw.ReadAt(5, Piece, 4), 4u);
+		AssertE(std::string(Piece, 4), "0\nli");
+		AssertE(Raw.Tell(), 0u);
+		auto const All = Raw.ReadAll();
+		AssertE(std::string(All.begin(), All.end()), Text);
+		Assert(!Raw);
+		AssertE(Raw.ReadAt(Text.size() - 2, Piece, 4), 2u);
+
+		std::vector<uint8_t> Chunk;
+		size_t Total = 0;
+		Raw.Seek(0);
+		while (Raw.Read(Chunk)) Total += Chunk.size();
+		AssertE(Total, Text.size());
+
+		auto Modify = Filesystem::RawFileT::OpenModify(TextPath);
+		Modify.WriteAt(0, "LINE", 4);
+		AssertE(Raw.ReadAt(0, Piece, 4), 4u);
+		AssertE(std::string(Piece, 4), "LINE");
+		Modify.WriteAt(0, "line", 4);
+	}
+
+	// Records
+	{
+		std::vector<uint8_t> Noise(300, 'x');
+		for (size_t Size = 0; Size < 200; ++Size)
+		{
+			for (size_t Offset = 0; Offset < 3; ++Offset)
+			{
+				auto const Data = Noise.data() + Offset;
+				AssertE(Filesystem::FindDelimiter(Data, Size, '\n'), nullptr);
+				for (size_t Position = 0; Position < Size; Position += 7)
+				{
+					Noise[Offset + Position] = '\n';
+					AssertE(Filesystem::FindDelimiter(Data, Size, '\n'), Data + Position);
+					Noise[Offset + Position] = 'x';
+				}
+			}
+		}
+
+		auto const Check = [&](Filesystem::RecordReaderT &&Reader)
+		{
+			std::string_view Record;
+			size_t Line = 0;
+			while (Reader.Next(Record)) 
+			{
+				AssertE(std::string(Record), "line " + std::to_string(Line));
+				++Line;
+			}
+			AssertE(Line, 10000u);
+			Assert(!Reader.Next(Record));
+		};
+		auto File = Filesystem::FileT::OpenRead(TextPath);
+		Check(Filesystem::RecordReaderT(File, '\n', ReadBufferT(3)));
+		auto Raw = Filesystem::RawFileT::OpenRead(TextPath);
+		Check(Filesystem::RecordReaderT(Raw, '\n', ReadBufferT::Ring(4096)));
+		auto const Mapped = Filesystem::MappedFileT::Open(TextPath);
+		Check(Filesystem::RecordReaderT(Mapped));
+
+		std::string const Fields = "a,,bc";
+		Filesystem::RecordReaderT Split(Fields.data(), Fields.size(), ',');
+		std::string_view Field;
+		std::vector<std::string> Found;
+		while (Split.Next(Field)) Found.emplace_back(Field);
+		Assert(Found == std::vector<std::string>({"a", "", "bc"}));
+	}
+
+	// Gathered writes
+	{
+		auto const GatheredPath = Scratch.Enter("gathered");
+		std::string Expected;
+		{
+			auto Raw = Filesystem::RawFileT::OpenWrite(GatheredPath);
+			std::vector<uint8_t> const Empty;
+			Raw.Write({std::string("head"), Empty, std::string_view(Text).substr(0, 6000)});
+			Expected += "head" + Text.substr(0, 6000);
+			Filesystem::WriteCombinerT Combiner(Raw, 100);
+			for (size_t Index = 0; Index < 50; ++Index)
+			{
+				auto const Header = std::to_string(Index) + ":";
+				Combiner.Write({Header, std::string("payload\n")});
+				Expected += Header + "payload\n";
+			}
+			Assert(Combiner.Pending() < 100u);
+			Combiner.Flush();
+			AssertE(Combiner.Pending(), 0u);
+			AssertE(Raw.Size(), Expected.size());
+		}
+		{
+			auto File = Filesystem::FileT::OpenAppend(GatheredPath);
+			File.Write(std::vector<uint8_t>());
+			File.Write({std::string("a"), std::string("b")});
+			File.Write({std::string("c"), std::string_view(Text)});
+			Expected += "abc" + Text;
+		}
+		auto const Written = Filesystem::FileT::OpenRead(GatheredPath).ReadAll();
+		AssertE(std::string(Written.begin(), Written.end()), Expected);
+	}
+
+	// Hints
+	{
+		auto const Hinted = Scratch.Enter("hinted");
+		{
+			auto Raw = Filesystem::RawFileT::OpenWrite(Hinted);
+			if (Raw.Preallocate(0, 1 << 20, true)) AssertE(Raw.Size(), 0u);
+			Raw.Write(Text);
+			Raw.SyncRange(0, 0);
+			Raw.SyncRange(0, Text.size(), true);
+			auto File = Filesystem::FileT::OpenAppend(Hinted);
+			File.Write(std::string("tail"));
+			File.SyncRange(0, 0, true);
+			if (File.Preallocate(0, Text.size() + 8)) AssertE(Raw.Size(), Text.size() + 8);
+		}
+		auto Raw = Filesystem::RawFileT::OpenRead(Hinted, Filesystem::AccessT::Sequential);
+		Raw.Readahead(0, 4096);
+		char Piece[4];
+		AssertE(Raw.ReadAt(Text.size(), Piece, 4), 4u);
+		AssertE(std::string(Piece, 4), "tail");
+		Raw.Advise(Filesystem::AccessT::DontNeed);
+		auto File = Filesystem::FileT::OpenRead(Hinted, Filesystem::AccessT::Random);
+		File.Readahead(0, 4096);
+		AssertE(File.ReadAll().size(), Raw.Size());
+	}
+
+	// Atomic replacement
+	{
+		auto const Published = Scratch.Enter("published");
+		Filesystem::FileT::OpenWrite(Published).Write(std::string("old"));
+		{
+			auto Write = Filesystem::AtomicWriteT::Open(Published);
+			Write.File().Write(std::string("new"));
+			auto const Old = Filesystem::FileT::OpenRead(Published).ReadAll();
+			AssertE(std::string(Old.begin(), Old.end()), "old");
+			Write.Commit();
+		}
+		auto const New = Filesystem::FileT::OpenRead(Published).ReadAll();
+		AssertE(std::string(New.begin(), New.end()), "new");
+		{
+			auto Abandoned = Filesystem::AtomicWriteT::Open(Scratch.Enter("abandoned"));
+			Abandoned.File().Write(std::string("lost"));
+		}
+		Assert(!Scratch.Enter("abandoned").Exists());
+
+		Filesystem::CommitGroupT Group;
+		for (size_t Index = 0; Index < 20; ++Index)
+			Filesystem::AtomicWriteT::Publish(Scratch.Enter("grouped" + std::to_string(Index)), std::string("data"), 0600, &Group);
+		AssertE(Group.Pending(), 1u);
+		Group.Commit();
+		AssertE(Group.Pending(), 0u);
+		AssertE(Scratch.Enter("grouped7").Stat()->Size, 4u);
+		AssertE(Scratch.Enter("grouped7").Stat()->Mode & 0777, 0600u);
+		size_t Hidden = 0;
+		Scratch.Scan([&](Filesystem::DirectoryEntryT const &Entry) { if (Entry.Name[0] == '.') ++Hidden; return true; });
+		AssertE(Hidden, 0u);
+	}
+
+	// Asynchronous
+	for (bool AllowRing : {true, false})
+	{
+		Filesystem::AsyncIOT IO(8, AllowRing);
+		if (!AllowRing) Assert(!IO.UsesRing());
+		std::vector<std::vector<uint8_t>> Buffers(20, std::vector<uint8_t>(Text.size()));
+		size_t Closed = 0, Stats = 0;
+		for (auto &Buffer : Buffers)
+		{
+			IO.Open(TextPath, O_RDONLY, [&](int64_t Descriptor)
+			{
+				Assert(Descriptor >= 0);
+				IO.Read(Descriptor, 0, Buffer.data(), Buffer.size(), [&, Descriptor](int64_t Read)
+				{
+					AssertE(Read, static_cast<int64_t>(Text.size()));
+					IO.Close(Descriptor, [&](int64_t Result) { AssertE(Result, 0); ++Closed; });
+				});
+			});
+		}
+		IO.Stat(TextPath, [&](OptionalT<Filesystem::StatT> const &Stat) { Assert(Stat); AssertE(Stat->Size, Text.size()); ++Stats; });
+		IO.Stat(Scratch.Enter("missing"), [&](OptionalT<Filesystem::StatT> const &Stat) { Assert(!Stat); ++Stats; });
+		IO.Open(Scratch.Enter("missing"), O_RDONLY, [&](int64_t Result) { AssertE(Result, -ENOENT); });
+		IO.Drain();
+		AssertE(Closed, Buffers.size());
+		AssertE(Stats, 2u);
+		for (auto &Buffer : Buffers) AssertE(std::string(Buffer.begin(), Buffer.end()), Text);
+
+		// Through RawFileT, which owns the descriptor until Close takes it
+		auto const Copied = Scratch.Enter(AllowRing ? "asyncring" : "asyncpool");
+		Filesystem::RawFileT Source, Destination;
+		std::vector<uint8_t> Buffer(Text.size());
+		bool Copy = false;
+		IO.OpenFile(TextPath, O_RDONLY, [&](Filesystem::RawFileT &&File, int64_t Result)
+		{
+			Assert(Result >= 0);
+			AssertE(File.Descriptor(), Result);
+			Source = std::move(File);
+			IO.Read(Source, 0, Buffer.data(), Buffer.size(), [&](int64_t Read)
+			{
+				AssertE(Read, static_cast<int64_t>(Text.size()));
+				IO.Close(std::move(Source), [&](int64_t Result) { AssertE(Result, 0); });
+				Assert(Source.Descriptor() < 0);
+				IO.OpenFile(Copied, O_WRONLY | O_CREAT | O_TRUNC, [&](Filesystem::RawFileT &&File, int64_t Result)
+				{
+					Assert(Result >= 0);
+					Destination = std::move(File);
+					IO.Write(Destination, 0, Buffer.data(), Buffer.size(), [&](int64_t Written)
+					{
+						AssertE(Written, static_cast<int64_t>(Text.size()));
+						IO.Close(std::move(Destination), [&](int64_t Result) { AssertE(Result, 0); Copy = true; });
+					});
+				});
+			});
+		});
+		IO.OpenFile(Scratch.Enter("missing"), O_RDONLY, [&](Filesystem::RawFileT &&File, int64_t Result)
+		{
+			AssertE(Result, -ENOENT);
+			Assert(File.Descriptor() < 0);
+		});
+		IO.Drain();
+		Assert(Copy);
+		auto const Written = Filesystem::FileT::OpenRead(Copied).ReadAll();
+		AssertE(std::string(Written.begin(), Written.end()), Text);
+	}
+
+#ifdef __linux__
+	// Watching
+	{
+		auto const Watched = Scratch.Enter("watched");
+		Assert(Watched.CreateDirectory());
+		Filesystem::WatcherT Watcher(Watched, std::chrono::milliseconds(20));
+		AssertE(Watcher.Watches(), 1u);
+		std::vector<Filesystem::WatchEventT> Events;
+		auto const Expect = [&](Filesystem::PathT const &Path, Filesystem::ChangeT Change)
+		{
+			for (size_t Attempt = 0; Attempt < 20; ++Attempt)
+			{
+				for (auto const &Event : Events)
+					if ((Event.Path == Path) && (Event.Change == Change)) return;
+				auto More = Watcher.Wait(std::chrono::milliseconds(250));
+				Events.insert(Events.end(), More.begin(), More.end());
+			}
+			Assert(false);
+		};
+
+		Filesystem::FileT::OpenWrite(Watched.Enter("a")).Write(std::string("a"));
+		Expect(Watched.Enter("a"), Filesystem::ChangeT::Created);
+
+		// Contents of a directory moved in are reported, and it's watched
+		auto const Outside = Scratch.Enter("outside");
+		Assert(Outside.CreateDirectory());
+		Assert(Outside.Enter("inner").CreateDirectory());
+		Filesystem::FileT::OpenWrite(Outside.Enter("inner").Enter("b")).Write(std::string("b"));
+		Assert(Outside.MoveTo(Watched.Enter("moved")));
+		Expect(Watched.Enter("moved").Enter("inner").Enter("b"), Filesystem::ChangeT::Created);
+		AssertE(Watcher.Watches(), 3u);
+
+		Filesystem::FileT::OpenAppend(Watched.Enter("moved").Enter("inner").Enter("b")).Write(std::string("c"));
+		Expect(Watched.Enter("moved").Enter("inner").Enter("b"), Filesystem::ChangeT::Modified);
+
+		// Created then deleted within the debounce cancels out
+		Events.clear();
+		Filesystem::FileT::OpenWrite(Watched.Enter("brief")).Write(std::string("x"));
+		Assert(Watched.Enter("brief").Delete());
+		Assert(Watched.Enter("a").Delete());
+		Expect(Watched.Enter("a"), Filesystem::ChangeT::Deleted);
+		for (auto const &Event : Events) Assert(Event.Path != Watched.Enter("brief"));
+
+		// A path that keeps changing is still reported within a few debounce periods
+		Events.clear();
+		auto const Busy = Watched.Enter("busy");
+		Filesystem::FileT::OpenWrite(Busy).Write(std::string("x"));
+		bool Reported = false;
+		for (size_t Append = 0; (Append < 100) && !Reported; ++Append)
+		{
+			Filesystem::FileT::OpenAppend(Busy).Write(std::string("x"));
+			for (auto const &Event : Watcher.Wait(std::chrono::milliseconds(5)))
+				if (Event.Path == Busy) Reported = true;
+		}
+		Assert(Reported);
+		Assert(Busy.Delete());
+		Expect(Busy, Filesystem::ChangeT::Deleted);
+
+		Assert(Watched.Enter("moved").MoveTo(Scratch.Enter("gone")));
+		Expect(Watched.Enter("moved").Enter("inner"), Filesystem::ChangeT::Deleted);
+		Expect(Watched.Enter("moved"), Filesystem::ChangeT::Deleted);
+		AssertE(Watcher.Watches(), 1u);
+
+		// Losing events rebuilds the watches and reports it
+		Assert(Watched.Enter("kept").Enter("inner").CreateDirectory());
+		Expect(Watched.Enter("kept").Enter("inner"), Filesystem::ChangeT::Created);
+		AssertE(Watcher.Watches(), 3u);
+		size_t Queued = 16384;
+		{
+			auto const Limit = Filesystem::FileT::OpenRead("/proc/sys/fs/inotify/max_queued_events").ReadAll();
+			if (!Limit.empty()) Queued = std::stoul(std::string(Limit.begin(), Limit.end()));
+		}
+		for (size_t Index = 0; Index < Queued / 2 + 1; ++Index) // At least create, modify and delete each
+		{
+			Filesystem::FileT::OpenWrite(Watched.Enter("flood")).Write(std::string("x"));
+			Assert(Watched.Enter("flood").Delete());
+		}
+		Expect(Watched, Filesystem::ChangeT::Overflow);
+		AssertE(Watcher.Watches(), 3u);
+		Assert(Watched.Enter("kept").DeleteDirectory());
+		Expect(Watched.Enter("kept").Enter("inner"), Filesystem::ChangeT::Deleted);
+		AssertE(Watcher.Watches(), 1u);
+
+		// Rebuilding a tree with more watches than the queue holds doesn't overflow again
+		size_t Allowed = 0;
+		{
+			auto const Limit = Filesystem::FileT::OpenRead("/proc/sys/fs/inotify/max_user_watches").ReadAll();
+			if (!Limit.empty()) Allowed = std::stoul(std::string(Limit.begin(), Limit.end()));
+		}
+		auto const Wide = Scratch.Enter("wide");
+		auto const Count = Queued + 64;
+		if (Allowed >= Count + 16)
+		{
+			Assert(Wide.CreateDirectory());
+			for (size_t Index = 0; Index < Count; ++Index) Assert(Wide.Enter(std::to_string(Index)).CreateDirectory());
+			Filesystem::WatcherT Large(Wide, std::chrono::milliseconds(20));
+			AssertE(Large.Watches(), Count + 1);
+			for (size_t Index = 0; Index < Queued / 2 + 1; ++Index)
+			{
+				Filesystem::FileT::OpenWrite(Wide.Enter("flood")).Write(std::string("x"));
+				Assert(Wide.Enter("flood").Delete());
+			}
+			bool Overflowed = false;
+			for (size_t Attempt = 0; (Attempt < 20) && !Overflowed; ++Attempt)
+				for (auto const &Event : Large.Wait(std::chrono::milliseconds(250)))
+					if ((Event.Path == Wide) && (Event.Change == Filesystem::ChangeT::Overflow)) Overflowed = true;
+			Assert(Overflowed);
+			AssertE(Large.Watches(), Count + 1);
+			Filesystem::FileT::OpenWrite(Wide.Enter("0").Enter("after")).Write(std::string("x"));
+			bool Seen = false;
+			for (size_t Attempt = 0; (Attempt < 20) && !Seen; ++Attempt)
+				for (auto const &Event : Large.Wait(std::chrono::milliseconds(250)))
+					if (Event.Path == Wide.Enter("0").Enter("after")) Seen = true;
+			Assert(Seen);
+		}
+	}
+#endif
+
+	// Hashing
+	{
+		auto const Sha = [](std::string const &Text)
+		{
+			Filesystem::Sha256T Hasher;
+			Hasher.Update(Text.data(), Text.size());
+			return Filesystem::Sha256T::Hex(Hasher.Finish());
+		};
+		AssertE(Sha(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+		AssertE(Sha("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+		AssertE(Sha("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+		std::vector<uint8_t> Data(100000);
+		for (size_t Index = 0; Index < Data.size(); ++Index) Data[Index] = static_cast<uint8_t>(Index * 131 + (Index >> 7));
+		// Fixed, so every kernel and platform must agree
+		AssertE(Filesystem::FastHash(Data.data(), Data.size()), 0xd8c4748913d2f56eULL);
+		AssertE(Filesystem::FastHash(Data.data(), 0), 0xfc0ed1c71041a5dfULL);
+		AssertE(Filesystem::FastHash(Data.data(), 1000), 0xb687323972dbc563ULL);
+		AssertE(Filesystem::FastHash(Data.data(), Data.size(), 7), 0x0823ea309dc85250ULL);
+		for (size_t Step : {1u, 63u, 64u, 1000u, 1024u, 4099u})
+		{
+			Filesystem::FastHasherT Hasher;
+			Filesystem::Sha256T Strong;
+			for (size_t Offset = 0; Offset < Data.size(); Offset += Step)
+			{
+				auto const Size = std::min(Step, Data.size() - Offset);
+				Hasher.Update(Data.data() + Offset, Size);
+				Strong.Update(Data.data() + Offset, Size);
+			}
+			AssertE(Hasher.Finish(), Filesystem::FastHash(Data.data(), Data.size()));
+			AssertE(Filesystem::Sha256T::Hex(Strong.Finish()), Sha(std::string(Data.begin(), Data.end())));
+		}
+		Assert(Filesystem::FastHash("a", 1) != Filesystem::FastHash("a\0", 2));
+		// Stripes are keyed by position, in whole blocks and in the tail
+		auto const SwapStripes = [](std::vector<uint8_t> Contents, size_t First, size_t Second)
+		{
+			std::swap_ranges(Contents.begin() + First, Contents.begin() + First + 64, Contents.begin() + Second);
+			return Contents;
+		};
+		for (auto const &Swap : std::vector<std::array<size_t, 3>>{{4096, 0, 64}, {4096, 1024, 1984}, {200, 0, 64}, {200, 64, 128}})
+		{
+			std::vector<uint8_t> Original(Data.begin(), Data.begin() + Swap[0]);
+			auto const Swapped = SwapStripes(Original, Swap[1], Swap[2]);
+			Assert(Original != Swapped);
+			Assert(Filesystem::FastHash(Original.data(), Original.size()) != Filesystem::FastHash(Swapped.data(), Swapped.size()));
+		}
+
+		auto const Hashed = Scratch.Enter("hashed");
+		Assert(Hashed.CreateDirectory());
+		std::vector<uint8_t> Large(3 << 20);
+		for (size_t Index = 0; Index < Large.size(); ++Index) Large[Index] = static_cast<uint8_t>(Index ^ (Index >> 11));
+		auto const Write = [&](std::string const &Name, std::vector<uint8_t> const &Contents)
+		{
+			Filesystem::FileT::OpenWrite(Hashed.Enter(Name)).Write(Contents);
+			return Hashed.Enter(Name);
+		};
+		auto Changed = Large;
+		Changed.back() ^= 1;
+		auto Shifted = Large;
+		Shifted.front() ^= 1;
+		std::vector<Filesystem::PathT> Paths{
+			Write("large1", Large), Write("large2", Large), Write("changed", Changed), Write("shifted", Shifted),
+			Write("empty1", {}), Write("empty2", {}), Write("small1", {1, 2, 3}), Write("small2", {1, 2, 3}),
+			Write("small3", {1, 2, 4}), Write("unique", {9}), Hashed.Enter("missing")};
+		Paths.push_back(Paths[0]);
+
+		Filesystem::HashSettingsT Settings;
+		Settings.Strong = true;
+		Settings.BufferSize = 5000; // Rounds up to a page
+		Settings.Threads = 4;
+		auto const Hashes = Filesystem::HashFiles(Paths, Settings);
+		AssertE(Hashes.size(), Paths.size());
+		for (size_t Index = 0; Index < Paths.size(); ++Index) Assert(Hashes[Index].Path == Paths[Index]);
+		AssertE(Hashes[0].Size, Large.size());
+		AssertE(Hashes[0].Fast, Filesystem::FastHash(Large.data(), Large.size()));
+		Filesystem::Sha256T Strong;
+		Strong.Update(Large.data(), Large.size());
+		Assert(Hashes[0].Strong && (*Hashes[0].Strong == Strong.Finish()));
+		AssertE(Hashes[2].Fast, Filesystem::FastHash(Changed.data(), Changed.size()));
+		Assert(!Hashes[0].Error);
+		Assert(Hashes[10].Error);
+
+		Settings.Strong = false;
+		Settings.Prefix = 4096;
+		Settings.MemoryLimit = 8192; // Two buffers, so two threads
+		size_t Called = 0;
+		Filesystem::HashFiles(Paths, Settings, [&](Filesystem::FileHashT &&Hash)
+		{
+			++Called;
+			if (Hash.Path != Paths[2]) return;
+			AssertE(Hash.Size, Large.size());
+			AssertE(Hash.Fast, Filesystem::FastHash(Large.data(), 4096));
+			Assert(!Hash.Strong);
+		});
+		AssertE(Called, Paths.size());
+
+		for (bool StrongDuplicates : {false, true})
+		{
+			Filesystem::HashSettingsT Duplicates;
+			Duplicates.Strong = StrongDuplicates;
+			auto const Groups = Filesystem::FindDuplicates(Paths, Duplicates);
+			AssertE(Groups.size(), 3u);
+			Assert(Groups[0] == (std::vector<Filesystem::PathT>{Paths[4], Paths[5]}));
+			Assert(Groups[1] == (std::vector<Filesystem::PathT>{Paths[0], Paths[1]}));
+			Assert(Groups[2] == (std::vector<Filesystem::PathT>{Paths[6], Paths[7]}));
+		}
+		{
+			// Same size and first 4 KiB, differing after
+			std::vector<uint8_t> Original(Data.begin(), Data.begin() + 8192);
+			auto const Permuted = std::vector<Filesystem::PathT>{
+				Write("permuted1", Original), Write("permuted2", SwapStripes(Original, 4096, 4160))};
+			for (bool StrongDuplicates : {false, true})
+			{
+				Filesystem::HashSettingsT Duplicates;
+				Duplicates.Strong = StrongDuplicates;
+				Assert(Filesystem::FindDuplicates(Permuted, Duplicates).empty());
+			}
+		}
+		Assert(Hashed.DeleteDirectory());
+	}
+
+	Assert(Scratch.DeleteDirectory());
+	return 0;
+}
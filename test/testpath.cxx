@@ -1,9 +1,24 @@
 #include <cassert>
 #include <iostream>
 #include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <sstream>
 
 #include "../path.h"
 #include "../file.h"
+#include "../instrument.h"
+#include "../snapshot.h"
+#include "../glob.h"
+
+#ifndef WINDOWS
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
 
 int main(int, char **)
 {
@@ -28,18 +43,66 @@ int main(int, char **)
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/./1").Render(), Prefix + SEP "a" SEP "1");
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/..").Render(), Prefix + SEP);
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/../1").Render(), Prefix + SEP "1");
+	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/b/c").RenderSize(), (Prefix + SEP "a" SEP "b" SEP "c").size());
+	AssertE(Filesystem::PathT::Absolute(Prefix + "/").RenderSize(), (Prefix + SEP).size());
 	Assert(Filesystem::PathT::Absolute(Prefix + "/").Contains(Filesystem::PathT::Absolute(Prefix + SEP)));
 	Assert(!Filesystem::PathT::Absolute(Prefix + "/a").Contains(Filesystem::PathT::Absolute(Prefix + SEP)));
 	Assert(Filesystem::PathT::Absolute(Prefix + "/").Contains(Filesystem::PathT::Absolute(Prefix + SEP "a")));
 	Assert(!Filesystem::PathT::Absolute(Prefix + "/a").Contains(Filesystem::PathT::Absolute(Prefix + SEP "b")));
 	Assert(!Filesystem::PathT::Absolute(Prefix + "/a/1").Contains(Filesystem::PathT::Absolute(Prefix + SEP "a" SEP "2")));
+	Assert(Filesystem::PathT::Absolute(Prefix + "/a/1") == Filesystem::PathT::Absolute(Prefix + "/a/./1/"));
+	Assert(Filesystem::PathT::Absolute(Prefix + "/a/1") != Filesystem::PathT::Absolute(Prefix + "/a/2"));
+	Assert(Filesystem::PathT::Absolute(Prefix + "/a") != Filesystem::PathT::Absolute(Prefix + "/a/1"));
+	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/1").Hash(), Filesystem::PathT::Absolute(Prefix + "/a/1").Hash());
+	{
+		Filesystem::PathTableT Table;
+		auto First = Table.Intern(Filesystem::PathT::Absolute(Prefix + "/a/1"));
+		auto Second = Table.Intern(Filesystem::PathT::Absolute(Prefix + "/a/1"));
+		AssertE(static_cast<Filesystem::PathElementT const *>(First), static_cast<Filesystem::PathElementT const *>(Second));
+		auto Sibling = Table.Enter(First.Exit(), "2");
+		AssertE(static_cast<Filesystem::PathElementT const *>(Sibling.Exit()), static_cast<Filesystem::PathElementT const *>(First.Exit()));
+		AssertE(Table.Size(), 4u);
+	}
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/c.txt").Filename(), "c.txt");
+	AssertE(*Filesystem::PathT::Absolute(Prefix + "/c.tar.gz").Extension(), ".gz");
+	Assert(!Filesystem::PathT::Absolute(Prefix + "/c").Extension());
+	Assert(!Filesystem::PathT::Absolute(Prefix + "/c.").Extension());
+	AssertE(Filesystem::PathT::Absolute(Prefix + "/a\\\\b//.\\c").Render(), Prefix + SEP "a" SEP "b" SEP "c");
 	Assert(Filesystem::PathT::Here().Enter("filesystemtesttree").Enter("a").Enter("1.txt").Exists());
 	Assert(!Filesystem::PathT::Here().Enter("filesystemtesttree").Enter("a").Enter("9.txt").Exists());
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/c.txt").Directory(), Prefix + SEP);
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/c.txt").Filename(), "c.txt");
 	AssertE(Filesystem::PathT::Absolute(Prefix + "/a/c.txt").Directory(), Prefix + SEP "a");
 
+	// Sharing across threads
+	{
+		auto const Root = Filesystem::PathT::Absolute(Prefix + "/shared");
+		std::vector<Filesystem::PathT> Leaves;
+		for (size_t Branch = 0; Branch < 8; ++Branch)
+		{
+			auto Leaf = Root.Enter(std::to_string(Branch));
+			for (size_t Depth = 0; Depth < 64; ++Depth) Leaf = Leaf.Enter("x");
+			Leaves.push_back(std::move(Leaf));
+		}
+		auto const Expected = Leaves[0].Render();
+		std::vector<std::thread> Threads;
+		for (size_t Thread = 0; Thread < std::max(4u, std::thread::hardware_concurrency()); ++Thread)
+			Threads.emplace_back([&, Thread](void)
+			{
+				for (size_t Iteration = 0; Iteration < 20000; ++Iteration)
+				{
+					Filesystem::PathT Copy = Leaves[(Thread + Iteration) % Leaves.size()];
+					auto Child = Copy.Enter("y");
+					Filesystem::PathT Moved(std::move(Child));
+					Copy = Moved.Exit().Exit();
+				}
+			});
+		for (auto &Thread : Threads) Thread.join();
+		AssertE(Leaves[0].Render(), Expected);
+		Leaves.clear();
+		AssertE(Root.Render(), Prefix + SEP "shared");
+	}
+
 	{
 		//std::vector<std::string> Files, Dirs;
 		std::set<std::string> Files, Dirs; // tup fuse error?  Was seeing a duplicated directory.
@@ -63,6 +126,374 @@ int main(int, char **)
 		AssertE(Dirs.count("a1"), 1u);
 	}
 
+	{
+		auto const Tree = Filesystem::PathT::Here().Enter("filesystemtesttree");
+		std::vector<std::string> Visited;
+		Filesystem::WalkT Ordered;
+		Ordered.Ordered = true;
+		Ordered.Before = [&](Filesystem::PathT const &Path, bool, bool) 
+			{ Visited.push_back(Path.Filename()); return Path.Filename() != "b"; };
+		Ordered.After = [&](Filesystem::PathT const &Path) { Visited.push_back("~" + Path.Filename()); };
+		Assert(Tree.Walk(Ordered));
+		AssertE(Visited.size(), 11u);
+		AssertE(Visited[0], "a");
+		AssertE(Visited[4], "a1");
+		AssertE(Visited[7], "~a1");
+		AssertE(Visited[8], "~a");
+		AssertE(Visited[9], "b");
+		AssertE(Visited[10], "~filesystemtesttree");
+
+		std::mutex Mutex;
+		std::set<std::string> Entries, Exited;
+		Filesystem::WalkT Parallel;
+		Parallel.Threads = 4;
+		Parallel.Before = [&](Filesystem::PathT const &Path, bool, bool) 
+		{ 
+			std::lock_guard<std::mutex> Lock(Mutex); 
+			Entries.insert(Path.Filename()); 
+			return true; 
+		};
+		Parallel.After = [&](Filesystem::PathT const &Path) 
+		{ 
+			std::lock_guard<std::mutex> Lock(Mutex); 
+			if (Path.Filename() == "a") AssertE(Exited.count("a1"), 1u);
+			Exited.insert(Path.Filename()); 
+		};
+		Assert(Tree.Walk(Parallel));
+		AssertE(Entries.size(), 9u);
+		AssertE(Exited.size(), 4u);
+
+		Entries.clear();
+		Parallel.MaxDepth = 1;
+		Assert(Tree.Walk(Parallel));
+		AssertE(Entries.size(), 2u);
+	}
+
+#ifndef WINDOWS
+	{
+		auto const Scratch = Filesystem::PathT::Temp(false);
+		Assert(Scratch.Enter("dir").CreateDirectory());
+		{ auto Created = Filesystem::FileT::OpenWrite(Scratch.Enter("file")); }
+		Assert(symlink("dir", Scratch.Enter("link").Render().c_str()) == 0);
+		std::map<std::string, Filesystem::EntryTypeT> Types;
+		Assert(Scratch.Scan([&](Filesystem::DirectoryEntryT const &Entry)
+		{
+			Assert(Entry.Inode != 0);
+			Types[std::string(Entry.Name)] = Entry.Type;
+			return true;
+		}));
+		AssertE(Types.size(), 3u);
+		Assert(Types["dir"] == Filesystem::EntryTypeT::Directory);
+		Assert(Types["file"] == Filesystem::EntryTypeT::File);
+		Assert(Types["link"] == Filesystem::EntryTypeT::Link);
+		{
+			auto Directory = Filesystem::DirectoryT::Open(Scratch);
+			Assert(Directory.FileExists("file"));
+			Assert(Directory.DirectoryExists("dir"));
+			Assert(Directory.CreateDirectory("made"));
+			auto Made = Directory.Enter("made");
+			AssertE(Made.Path().Render(), Scratch.Enter("made").Render());
+			auto const Descriptor = Made.OpenFile("inner", O_WRONLY | O_CREAT);
+			Assert(Descriptor >= 0);
+			close(Descriptor);
+			Assert(Made.Exists("inner"));
+			Assert(Directory.DeleteDirectory("made"));
+			Assert(!Directory.Exists("made"));
+		}
+		{
+			auto const Stat = Scratch.Enter("file").Stat();
+			Assert(Stat);
+			Assert(Stat->Type == Filesystem::EntryTypeT::File);
+			AssertE(Stat->Size, 0u);
+			Assert(Stat->Inode != 0);
+			Assert(Stat->Modified > 0);
+			Assert(!Scratch.Enter("missing").Stat());
+
+			Filesystem::StatCacheT Cache;
+			Filesystem::StatCacheT::ScopeT Scope(&Cache);
+			Assert(!Scratch.Enter("late").Exists());
+			{ auto Created = Filesystem::FileT::OpenWrite(Scratch.Enter("late")); }
+			Assert(!Scratch.Enter("late").FileExists());
+			Cache.Invalidate(Scratch.Enter("late"));
+			Assert(Scratch.Enter("late").FileExists());
+			AssertE(Cache.Size(), 1u);
+			Assert(Scratch.Enter("late").Delete());
+			Assert(!Scratch.Enter("late").Exists());
+		}
+		Assert(Scratch.Enter("deep").Enter("er").Enter("est").CreateDirectory());
+		Assert(Scratch.Enter("deep").Enter("er").Enter("est").DirectoryExists());
+		{
+			Filesystem::FileT::OpenWrite(Scratch.Enter("dir").Enter("content")).Write(std::string("copied"));
+			Assert(Scratch.Enter("dir").Enter("content").CopyTo(Scratch.Enter("dir").Enter("copy")));
+			AssertE(Scratch.Enter("dir").Enter("copy").Stat()->Size, 6u);
+			// Never onto the source itself, by any name
+			auto const Content = Scratch.Enter("dir").Enter("content");
+			Assert(!Content.CopyTo(Content));
+			Assert(link(Content.Render().c_str(), Scratch.Enter("dir").Enter("hardlink").Render().c_str()) == 0);
+			Assert(!Content.CopyTo(Scratch.Enter("dir").Enter("hardlink")));
+			AssertE(Content.Stat()->Size, 6u);
+			Assert(Scratch.Enter("dir").Enter("hardlink").Delete());
+			// Existing destinations get the source's permissions too
+			Assert(chmod(Content.Render().c_str(), 0600) == 0);
+			Assert(chmod(Scratch.Enter("dir").Enter("copy").Render().c_str(), 0644) == 0);
+			Assert(Content.CopyTo(Scratch.Enter("dir").Enter("copy")));
+			struct stat Mode;
+			Assert(stat(Scratch.Enter("dir").Enter("copy").Render().c_str(), &Mode) == 0);
+			AssertE(Mode.st_mode & 07777, 0600u);
+			Assert(Scratch.CopyTreeTo(Scratch.Enter("dir").Enter("tree"), 2));
+			auto const Tree = Scratch.Enter("dir").Enter("tree");
+			Assert(Tree.Enter("file").FileExists());
+			Assert(Tree.Enter("dir").Enter("content").FileExists());
+			Assert(Tree.Enter("link").Stat()->Type == Filesystem::EntryTypeT::Directory);
+			Assert(!Tree.Enter("dir").Enter("tree").Exists());
+			Assert(Tree.Enter("file").MoveTo(Tree.Enter("moved")));
+			Assert(!Tree.Enter("file").Exists());
+			Assert(Tree.Enter("moved").FileExists());
+			// Moving across filesystems keeps links as links
+			auto const Other = Filesystem::PathT::Qualify("/dev/shm").Enter("filesystem-move-test");
+			if (Other.Exit().DirectoryExists())
+			{
+				Assert(Other.CreateDirectory());
+				Assert(symlink("moved", Tree.Enter("symlink").Render().c_str()) == 0);
+				Assert(Tree.Enter("symlink").MoveTo(Other.Enter("symlink")));
+				Assert(!Tree.Enter("symlink").Exists());
+				std::vector<char> Target(16);
+				AssertE(readlink(Other.Enter("symlink").Render().c_str(), Target.data(), Target.size()), 5);
+				Assert(Other.DeleteDirectory());
+			}
+			Assert(Tree.DeleteDirectory());
+			Assert(Scratch.Enter("dir").Enter("copy").Delete());
+			Assert(Scratch.Enter("dir").Enter("content").Delete());
+		}
+		{
+			auto const Doomed = Scratch.Enter("doomed");
+			for (size_t Index = 0; Index < 8; ++Index)
+			{
+				auto const Branch = Doomed.Enter("branch" + std::to_string(Index)).Enter("leaf");
+				Assert(Branch.CreateDirectory());
+				Filesystem::FileT::OpenWrite(Branch.Enter("file")).Write(std::string("x"));
+			}
+			Assert(symlink(Scratch.Enter("dir").Render().c_str(), Doomed.Enter("outside").Render().c_str()) == 0);
+			size_t Failures = 0;
+			Assert(Doomed.DeleteDirectory([&](Filesystem::PathT const &, int) { ++Failures; }, 4));
+			AssertE(Failures, 0u);
+			Assert(!Doomed.Exists());
+			Assert(Scratch.Enter("dir").DirectoryExists());
+			Assert(Scratch.Enter("missing").DeleteDirectory());
+		}
+		{
+			// Few descriptors for a wide, deep tree and many threads
+			auto const Doomed = Scratch.Enter("crowded");
+			std::function<void(Filesystem::PathT const &, size_t)> Build = [&](Filesystem::PathT const &Directory, size_t Depth)
+			{
+				Assert(Directory.CreateDirectory());
+				Filesystem::FileT::OpenWrite(Directory.Enter("file")).Write(std::string("x"));
+				if (Depth < 8) for (size_t Index = 0; Index < 3; ++Index) Build(Directory.Enter(std::to_string(Index)), Depth + 1);
+			};
+			Build(Doomed, 1);
+			rlimit Original;
+			Assert(getrlimit(RLIMIT_NOFILE, &Original) == 0);
+			auto Limited = Original;
+			Limited.rlim_cur = 24;
+			Assert(setrlimit(RLIMIT_NOFILE, &Limited) == 0);
+			std::vector<int> Errors;
+			auto const Deleted = Doomed.DeleteDirectory([&](Filesystem::PathT const &, int Error) { Errors.push_back(Error); }, 8);
+			AssertE(Errors.size(), 0u);
+			Assert(Deleted);
+			Assert(!Doomed.Exists());
+
+			// With none to spare, failures are reported rather than retried forever
+			Build(Doomed, 7);
+			auto const Free = dup(0);
+			Assert(Free >= 0);
+			close(Free);
+			Limited.rlim_cur = Free + 2; // The parent and the top only
+			Assert(setrlimit(RLIMIT_NOFILE, &Limited) == 0);
+			Assert(!Doomed.DeleteDirectory([&](Filesystem::PathT const &, int Error) { Errors.push_back(Error); }, 8));
+			Assert(setrlimit(RLIMIT_NOFILE, &Original) == 0);
+			Assert(!Errors.empty());
+			Assert(std::all_of(Errors.begin(), Errors.end(), [](int Error) { return Error == EMFILE; }));
+			Assert(Doomed.DirectoryExists());
+			Assert(Doomed.DeleteDirectory());
+			Assert(!Doomed.Exists());
+		}
+		{
+			auto const Tree = Scratch.Enter("snapshot");
+			Assert(Tree.Enter("a").Enter("b").CreateDirectory());
+			Assert(Tree.Enter("c").CreateDirectory());
+			Filesystem::FileT::OpenWrite(Tree.Enter("a").Enter("b").Enter("file")).Write(std::string("1"));
+			Filesystem::FileT::OpenWrite(Tree.Enter("c").Enter("file")).Write(std::string("1"));
+			Filesystem::FileT::OpenWrite(Tree.Enter("top")).Write(std::string("1"));
+			// Age the directories so rescans trust their listings
+			auto const Age = [&](Filesystem::PathT const &Directory)
+			{
+				timespec const Times[2] = {{1000000000, 0}, {1000000000, 0}};
+				Assert(utimensat(AT_FDCWD, Directory.Render().c_str(), Times, 0) == 0);
+			};
+			for (auto const &Directory : {Tree, Tree.Enter("a"), Tree.Enter("a").Enter("b"), Tree.Enter("c")}) Age(Directory);
+
+			auto const First = Filesystem::SnapshotT::Scan(Tree);
+			AssertE(First.Count(), 7u);
+			Assert(First.Root() == Tree);
+			AssertE(std::string(First.Name(1)), "a");
+			Assert(First[1].Type == Filesystem::EntryTypeT::Directory);
+			auto const Found = First.Find(Tree.Enter("a").Enter("b").Enter("file"));
+			Assert(Found);
+			Assert(First.Path(*Found) == Tree.Enter("a").Enter("b").Enter("file"));
+			AssertE(First[*Found].Size, 1u);
+			Assert(!First.Find(Tree.Enter("a").Enter("missing")));
+			Assert(!First.Find(Scratch.Enter("dir")));
+
+			Filesystem::SnapshotDiffT Diff;
+			auto const Same = First.Rescan(Diff);
+			Assert(Diff.Empty());
+			AssertE(Same.Count(), First.Count());
+
+			// Contents changed in a trusted directory are only seen when restatting
+			Filesystem::FileT::OpenAppend(Tree.Enter("c").Enter("file")).Write(std::string("2"));
+			First.Rescan(Diff, false);
+			Assert(Diff.Empty());
+			First.Rescan(Diff);
+			AssertE(Diff.Modified.size(), 1u);
+			Assert(Diff.Modified[0] == Tree.Enter("c").Enter("file"));
+
+			Assert(Tree.Enter("a").DeleteDirectory());
+			Filesystem::FileT::OpenWrite(Tree.Enter("c").Enter("new")).Write(std::string("1"));
+			Assert(Tree.Enter("top").Delete());
+			Assert(Tree.Enter("top").CreateDirectory());
+			auto const Second = First.Rescan(Diff, false);
+			std::set<std::string> Added, Removed;
+			for (auto const &Path : Diff.Added) Added.insert(Path.Render());
+			for (auto const &Path : Diff.Removed) Removed.insert(Path.Render());
+			Assert(Added == (std::set<std::string>{Tree.Enter("c").Enter("new").Render(), Tree.Enter("top").Render()}));
+			Assert(Removed == (std::set<std::string>{
+				Tree.Enter("a").Render(), Tree.Enter("a").Enter("b").Render(),
+				Tree.Enter("a").Enter("b").Enter("file").Render(), Tree.Enter("top").Render()}));
+			AssertE(Second.Count(), 5u);
+
+			auto const Saved = Scratch.Enter("snapshot.index");
+			Second.Save(Saved);
+			auto Loaded = Filesystem::SnapshotT::Load(Saved);
+			Assert(Loaded);
+			AssertE(Loaded->Count(), Second.Count());
+			AssertE(Loaded->Taken(), Second.Taken());
+			Assert(Loaded->Root() == Tree);
+			Assert(Loaded->Find(Tree.Enter("c").Enter("new")));
+			Loaded->Rescan(Diff);
+			Assert(Diff.Empty());
+			// Parents pointing at themselves or ahead are rejected, not followed
+			auto const Bytes = Filesystem::FileT::OpenRead(Saved).ReadAll();
+			for (uint32_t Parent : {1u, 4u})
+			{
+				auto Corrupt = Bytes;
+				size_t const Offset = 40 + sizeof(Filesystem::SnapshotEntryT) + offsetof(Filesystem::SnapshotEntryT, Parent); // Entry 1, after the header
+				memcpy(Corrupt.data() + Offset, &Parent, sizeof(Parent));
+				Filesystem::FileT::OpenWrite(Saved).Write(Corrupt);
+				Assert(!Filesystem::SnapshotT::Load(Saved));
+			}
+			Filesystem::FileT::OpenWrite(Saved).Write(std::string("not a snapshot"));
+			Assert(!Filesystem::SnapshotT::Load(Saved));
+			Assert(!Filesystem::SnapshotT::Load(Scratch.Enter("missing")));
+			Assert(Saved.Delete());
+			Assert(Tree.DeleteDirectory());
+		}
+		size_t Count = 0;
+		Assert(Scratch.List([&](Filesystem::PathT &&, bool, bool) { ++Count; return false; }));
+		AssertE(Count, 1u);
+		Assert(Scratch.DeleteDirectory());
+		Assert(!Scratch.Exists());
+	}
+#endif
+
+	// Instrumentation
+	{
+		namespace Instrument = Filesystem::Instrument;
+		Instrument::Reset();
+		auto const Here = Filesystem::PathT::Here();
+		Here.Enter("missing").Exists();
+		std::thread([&](void) { Here.Stat(); }).join();
+		auto const Snapshot = Instrument::Snapshot();
+		auto const Expected = Instrument::Enabled() ? 2u : 0u;
+		AssertE(Snapshot[Instrument::OperationT::Stat].Calls, Expected);
+		uint64_t Bucketed = 0;
+		for (auto const Calls : Snapshot[Instrument::OperationT::Stat].Buckets) Bucketed += Calls;
+		AssertE(Bucketed, Expected);
+		if (Instrument::Enabled()) Assert(Snapshot[Instrument::CounterT::ElementsCreated] >= 1u);
+		Instrument::Reset();
+		AssertE(Instrument::Snapshot()[Instrument::OperationT::Stat].Calls, 0u);
+		std::stringstream Dumped;
+		Instrument::Dump(Dumped, Snapshot);
+		AssertE(Dumped.str().substr(0, 12), "{\"enabled\": ");
+		AssertE(std::string(Instrument::Name(Instrument::OperationT::ReadDirectory)), "ReadDirectory");
+	}
+
+	// Globs
+	{
+		auto const Glob = [](std::string const &Pattern) { return Filesystem::GlobT::Compile(Pattern); };
+		Assert(Glob("*.txt").Match("a.txt"));
+		Assert(Glob("*.txt").Match(".txt"));
+		Assert(!Glob("*.txt").Match("a.txt.bak"));
+		Assert(!Glob("*.txt").Match("dir/a.txt"));
+		Assert(Glob("a?c").Match("abc"));
+		Assert(!Glob("a?c").Match("ac"));
+		Assert(Glob("*a*b*c").Match("xxaxxbxxbxc"));
+		Assert(!Glob("*a*b*c").Match("xxaxxbxxbx"));
+		Assert(Glob("[a-c]x").Match("bx"));
+		Assert(!Glob("[!a-c]x").Match("bx"));
+		Assert(Glob("[^a-c]x").Match("dx"));
+		Assert(Glob("[]]").Match("]"));
+		Assert(Glob("[a-]").Match("-"));
+		Assert(Glob("\\*").Match("*"));
+		Assert(!Glob("\\*").Match("a"));
+		Assert(Glob("**").Match("a/b/c"));
+		Assert(Glob("**/*.h").Match("x.h"));
+		Assert(Glob("**/*.h").Match("a/b/x.h"));
+		Assert(Glob("src/**/**/test/*.cxx").Match("src/test/a.cxx"));
+		Assert(Glob("src/**/test/*.cxx").Match("src/a/b/test/a.cxx"));
+		Assert(!Glob("src/**/test/*.cxx").Match("src/a/b/tests/a.cxx"));
+		Assert(Glob("{src,include}/{a,b{c,d}}.{h,cxx}").Match("include/bd.cxx"));
+		Assert(!Glob("{src,include}/{a,b{c,d}}.{h,cxx}").Match("include/b.cxx"));
+		Assert(Glob("{a/b,c}/d").Match("a/b/d"));
+		Assert(Glob("a{,.bak}").Match("a"));
+		Assert(Glob("[{]x").Match("{x"));
+		for (auto const Bad : {"[abc", "{a,b", "a/{b/[}"})
+		{
+			bool Threw = false;
+			try { Glob(Bad); }
+			catch (...) { Threw = true; }
+			Assert(Threw);
+		}
+
+#ifndef WINDOWS
+		auto const Scratch = Filesystem::PathT::Temp(false);
+		for (auto const Directory : {"src/a/b", "src/c", "include/d", "other/e"})
+			Assert(Filesystem::PathT::Qualify(Scratch.Render() + "/" + Directory).CreateDirectory());
+		for (auto const File : {"src/a/b/x.cxx", "src/a/y.h", "src/c/z.cxx", "include/d/w.h", "other/e/v.cxx", "top.cxx"})
+			Filesystem::FileT::OpenWrite(Filesystem::PathT::Qualify(Scratch.Render() + "/" + File)).Write(std::string("x"));
+		auto const Walked = [&](std::string const &Pattern)
+		{
+			std::vector<std::string> Out;
+			Assert(Glob(Pattern).Walk(Scratch, [&](Filesystem::PathT &&Path, bool, bool)
+			{
+				Assert(Glob(Pattern).Match(Scratch, Path));
+				Out.push_back(Path.Render().substr(Scratch.Render().size() + 1));
+				return true;
+			}));
+			return Out;
+		};
+		Assert(Walked("**/*.cxx") == (std::vector<std::string>{"other/e/v.cxx", "src/a/b/x.cxx", "src/c/z.cxx", "top.cxx"}));
+		Assert(Walked("{src,include}/**/*.h") == (std::vector<std::string>{"include/d/w.h", "src/a/y.h"}));
+		Assert(Walked("src/*") == (std::vector<std::string>{"src/a", "src/c"}));
+		Assert(Walked("src/a/b/x.cxx") == (std::vector<std::string>{"src/a/b/x.cxx"}));
+		Assert(Walked("missing/**").empty());
+		size_t Visited = 0;
+		Assert(!Glob("**").Walk(Scratch, [&](Filesystem::PathT &&, bool, bool) { return ++Visited < 3; }));
+		AssertE(Visited, 3u);
+		Assert(!Glob("*").Match(Scratch, Scratch));
+		Assert(Scratch.DeleteDirectory());
+#endif
+	}
+
 	// ascii
 	{
 		std::string 
@@ -0,0 +1,252 @@
+#include "watch.h"
+
+#ifdef __linux__
+
+#include <cstring>
+#include <algorithm>
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../ren-cxx-basics/error.h"
+
+namespace Filesystem
+{
+
+static uint32_t const WatchMask =
+	IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+	IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+// A path that never goes quiet is still reported after this many debounce periods
+static int const MaxDebounces = 4;
+
+WatcherT::WatcherT(PathT const &Root, std::chrono::milliseconds Debounce) :
+	Root(Root),
+	Debounce(Debounce),
+	Core(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+	if (Core < 0) throw CONSTRUCTION_ERROR << "Unable to create inotify instance: " << strerror(errno);
+	try { WatchTree(Root, false); }
+	catch (...)
+	{
+		close(Core);
+		throw;
+	}
+	if (Descriptors.empty())
+	{
+		close(Core);
+		throw CONSTRUCTION_ERROR << "Unable to watch [" << Root << "]";
+	}
+}
+
+WatcherT::~WatcherT(void) { close(Core); }
+
+int WatcherT::Descriptor(void) const { return Core; }
+
+size_t WatcherT::Watches(void) const { return Descriptors.size(); }
+
+std::vector<WatchEventT> WatcherT::Wait(std::chrono::milliseconds Timeout)
+{
+	auto const Deadline = ClockT::now() + Timeout;
+	while (true)
+	{
+		Drain();
+
+		auto const Now = ClockT::now();
+		std::vector<std::pair<uint64_t, WatchEventT>> Ready;
+		auto Until = Deadline;
+		for (auto Event = Pending.begin(); Event != Pending.end();)
+		{
+			auto const Due = std::min(Event->second.Last + Debounce, Event->second.First + MaxDebounces * Debounce);
+			if (Due > Now)
+			{
+				Until = std::min(Until, Due);
+				++Event;
+				continue;
+			}
+			auto const &State = Event->second;
+			auto const Exists = State.Change != ChangeT::Deleted;
+			if (State.Change == ChangeT::Overflow)
+				Ready.push_back({State.Sequence, WatchEventT{Event->first, ChangeT::Overflow, true}});
+			else if (State.Existed || Exists)
+				Ready.push_back({State.Sequence, WatchEventT{
+					Event->first,
+					!State.Existed ? ChangeT::Created : !Exists ? ChangeT::Deleted : ChangeT::Modified,
+					State.IsDirectory}});
+			Event = Pending.erase(Event);
+		}
+		if (!Ready.empty())
+		{
+			std::sort(Ready.begin(), Ready.end(), [](auto const &First, auto const &Second) { return First.first < Second.first; });
+			std::vector<WatchEventT> Out;
+			Out.reserve(Ready.size());
+			for (auto &Event : Ready) Out.push_back(std::move(Event.second));
+			return Out;
+		}
+
+		if (Now >= Deadline) return {};
+		auto const Milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(Until - Now).count() + 1;
+		pollfd Poll{Core, POLLIN, 0};
+		if ((poll(&Poll, 1, static_cast<int>(std::min<int64_t>(Milliseconds, INT32_MAX))) < 0) && (errno != EINTR))
+			throw SYSTEM_ERROR << "Error waiting for inotify events: " << strerror(errno);
+	}
+}
+
+void WatcherT::WatchTree(PathT const &Directory, bool Report)
+{
+	// Watch before listing, so anything created meanwhile is either listed or an event
+	// (or both, which merges)
+	auto const Add = [&](PathT const &Path)
+	{
+		auto const Watch = inotify_add_watch(Core, Path.Render().c_str(), WatchMask);
+		if (Watch < 0)
+		{
+			if ((errno == ENOENT) || (errno == ENOTDIR)) return false; // Gone already
+			throw SYSTEM_ERROR << "Unable to watch [" << Path << "]: " << strerror(errno);
+		}
+		Paths[Watch] = Path;
+		Descriptors[Path] = Watch;
+		if (Path != Root) Children[Path.Exit()].insert(Path);
+		return true;
+	};
+	if (!Add(Directory)) return;
+	WalkT Walk;
+	Walk.Ordered = true;
+	Walk.Before = [&](PathT const &Path, bool, bool IsDirectory)
+	{
+		if (Report) Note(Path, ChangeT::Created, IsDirectory);
+		return IsDirectory && Add(Path);
+	};
+	Directory.Walk(Walk);
+}
+
+void WatcherT::Unwatch(PathT const &Directory, bool Report)
+{
+	// Through the child index, so this costs the size of the subtree, not of the tree
+	Forget(Directory);
+	std::vector<PathT> Stack{Directory};
+	while (!Stack.empty())
+	{
+		auto const Path = std::move(Stack.back());
+		Stack.pop_back();
+		auto const Below = Children.find(Path);
+		if (Below != Children.end())
+		{
+			Stack.insert(Stack.end(), Below->second.begin(), Below->second.end());
+			Children.erase(Below);
+		}
+		auto const Watched = Descriptors.find(Path);
+		if (Watched == Descriptors.end()) continue; // Ignored already
+		if (Report && (Path != Directory)) Note(Path, ChangeT::Deleted, true);
+		inotify_rm_watch(Core, Watched->second);
+		Paths.erase(Watched->second);
+		Descriptors.erase(Watched);
+	}
+}
+
+void WatcherT::Forget(PathT const &Directory)
+{
+	if (Directory == Root) return;
+	auto const Parent = Children.find(Directory.Exit());
+	if (Parent == Children.end()) return;
+	Parent->second.erase(Directory);
+	if (Parent->second.empty()) Children.erase(Parent);
+}
+
+void WatcherT::Rebuild(void)
+{
+	// Removing watches one at a time queues an IN_IGNORED each, which overflows again on
+	// trees with more directories than the queue holds.  Swapping in a fresh instance
+	// drops them all at once and keeps Descriptor() valid.
+	auto const Fresh = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (Fresh < 0) throw SYSTEM_ERROR << "Unable to create inotify instance: " << strerror(errno);
+	auto const Replaced = dup3(Fresh, Core, O_CLOEXEC);
+	auto const Error = errno;
+	close(Fresh);
+	if (Replaced < 0) throw SYSTEM_ERROR << "Unable to replace inotify instance: " << strerror(Error);
+	Paths.clear();
+	Descriptors.clear();
+	Children.clear();
+	WatchTree(Root, false);
+}
+
+void WatcherT::Drain(void)
+{
+	alignas(inotify_event) char Buffer[65536];
+	while (true)
+	{
+		auto const Read = read(Core, Buffer, sizeof(Buffer));
+		if (Read < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) return;
+			throw SYSTEM_ERROR << "Error reading inotify events: " << strerror(errno);
+		}
+		for (ssize_t Offset = 0; Offset < Read;)
+		{
+			auto const Event = reinterpret_cast<inotify_event const *>(Buffer + Offset);
+			Offset += sizeof(inotify_event) + Event->len;
+
+			if (Event->mask & IN_Q_OVERFLOW)
+			{
+				// Always last in the queue, and anything else read belongs to the old instance
+				Rebuild();
+				Note(Root, ChangeT::Overflow, true);
+				break;
+			}
+			auto const Found = Paths.find(Event->wd);
+			if (Found == Paths.end()) continue; // Removed while its events were queued
+			auto const Directory = Found->second;
+			if (Event->mask & IN_IGNORED)
+			{
+				// Its watched subdirectories stay indexed until they're ignored too
+				Forget(Directory);
+				Descriptors.erase(Directory);
+				Paths.erase(Found);
+				continue;
+			}
+			if (Event->len == 0)
+			{
+				// About the watched directory itself; its parent reports everything but this
+				if ((Directory == Root) && (Event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+					Note(Root, ChangeT::Deleted, true);
+				continue;
+			}
+			auto const Path = Directory.Enter(Event->name);
+			bool const IsDirectory = Event->mask & IN_ISDIR;
+			if (Event->mask & (IN_CREATE | IN_MOVED_TO))
+			{
+				Note(Path, ChangeT::Created, IsDirectory);
+				if (IsDirectory) WatchTree(Path, true);
+			}
+			else if (Event->mask & (IN_DELETE | IN_MOVED_FROM))
+			{
+				Note(Path, ChangeT::Deleted, IsDirectory);
+				if (IsDirectory) Unwatch(Path, true);
+			}
+			else if (Event->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB))
+				Note(Path, ChangeT::Modified, IsDirectory);
+		}
+	}
+}
+
+void WatcherT::Note(PathT const &Path, ChangeT Change, bool IsDirectory)
+{
+	auto const Now = ClockT::now();
+	auto Found = Pending.find(Path);
+	if (Found == Pending.end())
+	{
+		Pending.emplace(Path, PendingT{Change, IsDirectory, Change != ChangeT::Created, Sequence++, Now, Now});
+		return;
+	}
+	auto &State = Found->second;
+	if (State.Change != ChangeT::Overflow) State.Change = Change;
+	State.IsDirectory = IsDirectory;
+	State.Last = Now;
+}
+
+}
+
+#endif
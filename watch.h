@@ -0,0 +1,83 @@
+#ifndef ren_cxx_filesystem__watch_h
+#define ren_cxx_filesystem__watch_h
+
+#include "path.h"
+
+#include <chrono>
+#include <vector>
+#include <unordered_set>
+
+#ifdef __linux__
+namespace Filesystem
+{
+
+enum struct ChangeT
+{
+	Created,
+	Modified,
+	Deleted,
+	Overflow // Events were lost; the path is the root and watches have been rebuilt
+};
+
+struct WatchEventT
+{
+	PathT Path;
+	ChangeT Change;
+	bool IsDirectory;
+};
+
+// Watches a directory tree with inotify.  Directories created or moved into the tree
+// are watched as they appear, and their existing contents are reported as created.
+// Directories moved out are reported deleted along with the directories they contained,
+// but not the files, which inotify doesn't list once they're gone.
+//
+// Events for a path are merged until the path has been quiet for Debounce, or for at most
+// four times Debounce after its first event if it never goes quiet: created then deleted
+// cancels out, deleted then created becomes modified, and so on.  Not thread-safe.
+struct WatcherT
+{
+	WatcherT(PathT const &Root, std::chrono::milliseconds Debounce = std::chrono::milliseconds(50));
+	WatcherT(WatcherT const &Other) = delete;
+	WatcherT &operator =(WatcherT const &Other) = delete;
+	~WatcherT(void);
+
+	int Descriptor(void) const; // Readable when events are queued, for use with poll
+	size_t Watches(void) const;
+
+	// Returns settled events in the order they were first seen, waiting up to Timeout
+	// for some.  Empty if none settled in time.
+	std::vector<WatchEventT> Wait(std::chrono::milliseconds Timeout);
+
+	private:
+		using ClockT = std::chrono::steady_clock;
+		struct PendingT
+		{
+			ChangeT Change;
+			bool IsDirectory;
+			bool Existed; // Whether the path existed before the first merged event
+			uint64_t Sequence;
+			ClockT::time_point First;
+			ClockT::time_point Last;
+		};
+
+		void WatchTree(PathT const &Directory, bool Report);
+		void Unwatch(PathT const &Directory, bool Report); // Reports the watched directories below
+		void Forget(PathT const &Directory); // Drops it from its parent's children
+		void Rebuild(void);
+		void Drain(void);
+		void Note(PathT const &Path, ChangeT Change, bool IsDirectory);
+
+		PathT const Root;
+		std::chrono::milliseconds const Debounce;
+		int Core;
+		std::unordered_map<int, PathT> Paths;
+		std::unordered_map<PathT, int> Descriptors;
+		std::unordered_map<PathT, std::unordered_set<PathT>> Children; // Watched subdirectories by parent
+		std::unordered_map<PathT, PendingT> Pending;
+		uint64_t Sequence = 0;
+};
+
+}
+#endif
+
+#endif